@@ -25,9 +25,30 @@
 #include <getopt.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
+#include <pwd.h>
+#include <sys/stat.h>
 #include "fileops.h"
 #include "firstrun.h"
 #include "getoptions.h"
+#include "status.h"
+#include "fleet.h"
+#include "battery.h"
+#include "history.h"
+#include "countdown.h"
+#include "uevent.h"
+#include "suspend.h"
+#include "sampler.h"
+#include "soc.h"
+#include "profile.h"
+#include "measure.h"
+#include "load.h"
+#include "reload.h"
+#include "resume.h"
+
+#define USER_CFG ".config/autosd/autosd.cfg"
+#define SYS_CFG "/etc/autosd.conf"
+#define SYS_DIR "/var/lib/autosd"
 
 typedef struct cfgdata {
 	char cfgname[NAME_MAX];
@@ -38,29 +59,88 @@ typedef struct cfgprm {
 	int batquit;	// battery % quit level
 	int batmon;		// battery % to start monitoring
 	int interval;	// when monitoring check interval minutes.
+	int shutmins;	// minutes of runtime needed to shut down
+	int grace;		// seconds for mains to return before shutdown
+	int suspwake;	// wake from suspend to check the battery
+	int resdelay;	// most seconds to hold the resume gate after mains
+	int reslevel;	// battery % before the resume gate opens
 } cfgprm;
 
 static cfgdata split_cfg_line(char *cfgline);
 static int inlist(const char *candidate, char **list);
 static void freelist(char **list);
 static void suicide(void);
+static int consolekit(const char *method);
 static void is_this_first_run(char *progname);
 static void check_prior_instance_running(char *progname);
-static cfgprm get_config_parameters(const char *relpath);
-static void sanity_check(int what, int lt, int gt, const char *thename);
-static void check_power_status(int monitor, cfgprm prms);
-static void check_set_config_values(int res, cfgprm *prms, cfgdata cd);
+static cfgprm default_parameters(void);
+static cfgprm get_config_parameters(const char *relpath, cfgprm prms);
+static int parse_config(const char *relpath, cfgprm *prms);
+static int parse_lines(char **cflines, const char *path, cfgprm *prms);
+static cfgprm get_system_parameters(void);
+static int merge_system_parameters(cfgprm *all, int watch);
+static int reload_user(void *blk);
+static int reload_system(void *blk);
+static void config_changed(void);
+static void run_system_daemon(options_t opts);
+static int sanity_check(int what, int lt, int gt, const char *thename);
+static int check_power_status(options_t opts, cfgprm prms, int woken);
+static int check_set_config_values(int res, cfgprm *prms, cfgdata cd);
 static void get_cfg_name(char *src, char *name, const char sep);
 static void get_cfg_value(char *src, char *val, const char sep);
 static void strip_space(char *buf);
+static void publish_status(int state, const batsample_t *bs, int minsleft,
+							cfgprm prms);
+static int predict_minutes(int p0, time_t t0, int percent, int batquit);
+static void check_wear(cfgprm prms);
+static void wait_for_change(int *ufd, suspguard_t *sg, const batsample_t *bs,
+							cfgprm prms, int monitor, int fast);
+static void wait_kickable(suspguard_t *sg, int ufd);
+
+static int dryrun;	// print the shutdown command, don't run it.
+static int sysmode;	// one system daemon rather than per user cron jobs
+static char usercfg[PATH_MAX];	// absolute, for the reload thread
+static suspguard_t *waiting;	// the wait a config reload may end
 
 int main(int argc, char **argv)
 {
 	options_t opts = process_options(argc, argv);
+	if (opts.status) exit(status_show());
+	if (opts.history) {
+		// the daemon keeps the one history for the machine.
+		if (status_daemon_running()) history_file(SYS_DIR "/history.rrd");
+		exit(history_show(opts.history));
+	}
+	if (opts.waitresume) exit(resume_wait());
+	if (opts.profile) {
+		exit(profile_power(opts.profile,
+				opts.output ? opts.output : PROF_OUTPUT, opts.seconds));
+	}
+	if (opts.measure) {
+		exit(measure(opts.measure, opts.repeat ? opts.repeat : 1));
+	}
+	dryrun = opts.dryrun;
+	if (opts.listen) fleet_listen(opts.listen, suicide, dryrun);
+	if (opts.coordinate) fleet_check();
+	if (opts.coordinate && dryrun) {	// try the fleet out, now
+		fleet_shutdown(-1);
+		exit(EXIT_SUCCESS);
+	}
+	if (opts.daemon) run_system_daemon(opts);
+	if (!opts.monitor && status_daemon_running()) {
+		exit(EXIT_SUCCESS);	// the system daemon looks after it
+	}
 	is_this_first_run("autosd");
 	check_prior_instance_running("autosd");
-	cfgprm prms = get_config_parameters(".config/autosd/autosd.cfg");
-	check_power_status(opts.monitor, prms);
+	cfgprm prms = get_config_parameters(USER_CFG, default_parameters());
+	strcpy(usercfg, get_realpath_home(USER_CFG));
+	char dir[PATH_MAX];
+	strcpy(dir, usercfg);
+	*strrchr(dir, '/') = '\0';
+	reload_watch(dir, strrchr(usercfg, '/') + 1);
+	reload_start(&prms, sizeof(cfgprm), reload_user, config_changed);
+	// mains failed again while the resume gate was held, look again.
+	while (check_power_status(opts, prms, 0) == -1);
 
 	return 0;
 }//main()
@@ -97,17 +177,30 @@ void freelist(char **list)
 
 void suicide(void)
 {	/* Shut myself down - must be root. */
-	char *command = "dbus-send --system "
+	consolekit("Stop");
+} // suicide()
+
+static int consolekit(const char *method)
+{	/* Ask ConsoleKit to Stop, Suspend or Hibernate the machine. Returns
+	 * 0 when it was done.
+	*/
+	char command[PATH_MAX];
+	sprintf(command, "dbus-send --system "
 	"--dest=org.freedesktop.ConsoleKit --type=method_call --print-reply"
 	" --reply-timeout=2000 /org/freedesktop/ConsoleKit/Manager "
-	"org.freedesktop.ConsoleKit.Manager.Stop";
+	"org.freedesktop.ConsoleKit.Manager.%s", method);
+	if (dryrun) {
+		fprintf(stdout, "Dry run: %s\n", command);
+		fflush(stdout);
+		return 0;
+	}
 	int res = system(command);
 	if (res == -1) {
 		fprintf(stderr, "Command failed: %s\n", command);
 		exit(EXIT_FAILURE);
 	}
-
-} // suicide()
+	return !WIFEXITED(res) || WEXITSTATUS(res);
+} // consolekit()
 
 void is_this_first_run(char *progname)
 {
@@ -130,79 +223,335 @@ static void check_prior_instance_running(char *progname)
 	}
 } // check_prior_instance_running()
 
-static cfgprm get_config_parameters(const char *relpath)
-{
-	char **cflines = readcfg(relpath);
+static cfgprm default_parameters(void)
+{	// as installed, for parameters that are left out.
 	cfgprm prms;
+	prms.interval = 5 * 60;
+	prms.batmon = 50;
+	prms.batquit = 7;
+	prms.shutmins = 2;
+	prms.grace = 0;
+	prms.suspwake = 0;
+	prms.resdelay = 60;
+	prms.reslevel = 20;
+	return prms;
+} // default_parameters()
+
+static cfgprm get_config_parameters(const char *relpath, cfgprm prms)
+{	/* Parameters in the file replace those in prms. */
+	if (parse_config(relpath, &prms) == -1) exit(EXIT_FAILURE);
+	return prms;
+} // get_config_parameters()
+
+static int parse_config(const char *relpath, cfgprm *prms)
+{	/* As get_config_parameters() but returns -1, having said why, if
+	 * the file is unreadable or any parameter unknown or insane.
+	*/
+	return parse_lines(trycfg(relpath), relpath, prms);
+} // parse_config()
+
+static int parse_lines(char **cflines, const char *path, cfgprm *prms)
+{	/* The parameters of config lines from trycfg(), freed here. */
+	if (!cflines) {
+		fprintf(stderr, "Can not use config file %s\n", path);
+		return -1;
+	}
 	int cflidx = 0;
-	while (cflidx < 3) {
-		char *list[4] = {"check_interval", "monitor_level", "quit_level"
-							,(char *)NULL };
+	int ok = 0;
+	while (cflines[cflidx] && ok == 0) {
+		char *list[9] = {"check_interval", "monitor_level", "quit_level"
+							, "shutdown_minutes", "grace_seconds"
+							, "suspend_wake", "resume_delay"
+							, "resume_level", (char *)NULL };
 		cfgdata cd = split_cfg_line(cflines[cflidx]);
 		int res = inlist(cd.cfgname, list);
-		check_set_config_values(res, &prms, cd);
+		ok = check_set_config_values(res, prms, cd);
 		cflidx++;
 	} // while()
 	freelist(cflines);
-	return prms;
-} // get_config_parameters()
+	return ok;
+} // parse_lines()
+
+static cfgprm get_system_parameters(void)
+{
+	cfgprm all;
+	if (merge_system_parameters(&all, 1) == -1) exit(EXIT_FAILURE);
+	return all;
+} // get_system_parameters()
+
+static int merge_system_parameters(cfgprm *all, int watch)
+{	/* /etc/autosd.conf, with each user's own autosd.cfg laid over it
+	 * as that user's policy. The policies are merged here, at start and
+	 * after an edit, so every sample is checked against one set of
+	 * thresholds however many users there are: the highest quit and
+	 * monitor levels and the shortest check interval and grace period
+	 * win. With watch, each file found is watched for edits. A user's
+	 * file that will not parse is reported and left out; only a bad
+	 * /etc/autosd.conf fails the merge.
+	*/
+	cfgprm sys = default_parameters();
+	if (parse_config(SYS_CFG, &sys) == -1) return -1;
+	*all = sys;
+	if (watch) reload_watch("/etc", strrchr(SYS_CFG, '/') + 1);
+	int nusers = 0, nskipped = 0;
+	struct passwd *pw;
+	setpwent();
+	while ((pw = getpwent())) {
+		char path[PATH_MAX];
+		if (pw->pw_uid < 1000) continue;	// system accounts
+		sprintf(path, "%s/%s", pw->pw_dir, USER_CFG);
+		if (fileexists(path) == -1) continue;
+		cfgprm usr = sys;
+		// Read as root, so only the user's own file, never a link.
+		int bad = (parse_lines(trycfg_owned(path, pw->pw_uid), path,
+								&usr) == -1);
+		if (bad) {	// one user's mistake must not stop the daemon
+			fprintf(stderr, "Skipped %s until it is corrected.\n", path);
+			nskipped++;
+		}
+		if (watch) {	// bad or not, so that a correction is seen
+			*strrchr(path, '/') = '\0';
+			reload_watch(path, strrchr(USER_CFG, '/') + 1);
+		}
+		if (bad) continue;
+		if (usr.batquit > all->batquit) all->batquit = usr.batquit;
+		if (usr.batmon > all->batmon) all->batmon = usr.batmon;
+		if (usr.interval < all->interval) all->interval = usr.interval;
+		if (usr.shutmins > all->shutmins) all->shutmins = usr.shutmins;
+		if (usr.grace < all->grace) all->grace = usr.grace;
+		if (usr.suspwake) all->suspwake = 1;
+		if (usr.resdelay > all->resdelay) all->resdelay = usr.resdelay;
+		if (usr.reslevel > all->reslevel) all->reslevel = usr.reslevel;
+		nusers++;
+	}
+	endpwent();
+	fprintf(stdout, "%s and %d user policies (%d skipped):"
+			" check_interval=%d monitor_level=%d quit_level=%d\n",
+			SYS_CFG, nusers, nskipped, all->interval / 60, all->batmon,
+			all->batquit);
+	fflush(stdout);
+	return 0;
+} // merge_system_parameters()
+
+static int reload_user(void *blk)
+{	/* Parse an edited autosd.cfg for the reload thread. Parameters
+	 * left out go back to their defaults, as they would in a new run.
+	*/
+	cfgprm prms = default_parameters();
+	if (parse_config(usercfg, &prms) == -1) return -1;
+	*(cfgprm *)blk = prms;
+	fprintf(stdout, "Reloaded %s: check_interval=%d monitor_level=%d"
+			" quit_level=%d\n", usercfg, prms.interval / 60,
+			prms.batmon, prms.batquit);
+	fflush(stdout);
+	return 0;
+} // reload_user()
+
+static int reload_system(void *blk)
+{	/* As reload_user(), merging all the policies again. */
+	return merge_system_parameters(blk, 0);
+} // reload_system()
 
-void sanity_check(int what, int lt, int gt, const char *thename)
+static void config_changed(void)
+{	/* From the reload thread: end any wait so that the next sample is
+	 * checked against the new settings now, not check_interval or a
+	 * battery alarm set for the old quit_level from now.
+	*/
+	suspguard_t *sg = __atomic_load_n(&waiting, __ATOMIC_ACQUIRE);
+	if (sg) suspend_kick(sg);
+} // config_changed()
+
+static void run_system_daemon(options_t opts)
+{	/* One instance for the whole machine in place of a cron job per
+	 * user. It samples at check_interval for ever.
+	*/
+	if (fileexists(SYS_CFG) == -1) {
+		fprintf(stderr, "System mode needs %s, a copy of autosd.cfg.\n",
+				SYS_CFG);
+		exit(EXIT_FAILURE);
+	}
+	sysmode = 1;
+	cfgprm prms = get_system_parameters();
+	mkdir(SYS_DIR, 0755);
+	history_file(SYS_DIR "/history.rrd");
+	soc_dir(SYS_DIR);
+	load_dir(SYS_DIR, 1);
+	reload_start(&prms, sizeof(cfgprm), reload_system, config_changed);
+	suspguard_t sg;	// count time suspended, unlike sleep()
+	int wake = -1;	// suspend_wake sg was made for
+	while (1) {
+		prms = *(const cfgprm *)reload_current();
+		if (prms.suspwake != wake) {	// at start or reloaded
+			if (wake != -1) suspend_close(&sg);
+			wake = prms.suspwake;
+			suspend_init(&sg, wake);
+		}
+		int woken = sg.ours;
+		sg.ours = 0;
+		while (check_power_status(opts, prms, woken) == -1) woken = 0;
+		suspend_arm(&sg, prms.interval, -1);
+		wait_kickable(&sg, -1);
+	}
+} // run_system_daemon()
+
+int sanity_check(int what, int lt, int gt, const char *thename)
 {
 	char *fmt = "Insane value for '%s' in config file.\n";
 	if (what < lt || what > gt) {
 		fprintf(stderr, fmt, thename);
-		exit(EXIT_FAILURE);
+		return -1;
 	}
+	return 0;
 } // sanity_check()
 
-static void check_power_status(int monitor, cfgprm prms)
-{
-	const char *ac0 = "/sys/class/power_supply/AC0/online";
-	const char *bat0 = "/sys/class/power_supply/BAT0/capacity";
-	char *sysbuf = readpseudofile(ac0, 'c');
-	int poweroff = (sysbuf[0] == '0');
-	sysbuf = readpseudofile(bat0, 's');
-	int percent = strtol(sysbuf, NULL, 10);	// % battery charge
-	while (poweroff) {
-		if (percent < prms.batquit) suicide();
-		if (percent > prms.batmon && !monitor) {
-			return;	// back to cron
+static int check_power_status(options_t opts, cfgprm prms, int woken)
+{	/* woken: the daemon's wake alarm has just brought the machine out of
+	 * a suspend, which is put back once the battery has been looked at.
+	 * Returns -1 if mains failed again while the resume gate was held,
+	 * when the caller must look again at once, else 0.
+	*/
+	batsample_t bs;
+	soc_t sc = { -1, 0 };	// charge left by voltage
+	take_sample(&bs);
+	if (!bs.estimated) {	// a late read tells nothing new
+		soc_update(&bs, &sc);
+		load_update(&bs);
+		if (history_update(&bs)) check_wear(prms);
+	}
+	int p0 = bs.percent;	// start of this discharge, for prediction
+	time_t t0 = bs.when;
+	publish_status(ST_IDLE, &bs, -1, prms);
+	int ufd = -1;	// uevent socket, opened when first needed
+	suspguard_t sg;
+	suspend_init(&sg, prms.suspwake);
+	sg.ours = woken;
+	if (woken && bs.acon) consolekit("Suspend boolean:true");
+	while (!bs.acon) {
+		const cfgprm *live = reload_current();
+		if (live) prms = *live;	// an edit may have been reloaded
+		resume_outage();
+		int percent = bs.percent;
+		// an aged battery's gauge may read high, trust the lower.
+		if (sc.percent >= 0 && sc.percent < percent) percent = sc.percent;
+		int minsleft = predict_minutes(p0, t0, percent, prms.batquit);
+		if (sc.cliff) {
+			fputs("Battery voltage is falling away, shutting down now.\n",
+					stderr);
+			publish_status(ST_SHUTDOWN, &bs, 0, prms);
+			soc_end_discharge(1);
+			if (opts.coordinate) fleet_shutdown(0);
+			suicide();
+		}
+		if (percent < prms.batquit) {
+			publish_status(ST_SHUTDOWN, &bs, 0, prms);
+			if (prms.grace && countdown(prms.grace, percent)) {
+				take_sample(&bs);	// mains is back
+				continue;
+			}
+			soc_end_discharge(0);	// we stop it, it didn't run flat
+			if (opts.coordinate) {
+				int mins = predict_minutes(p0, t0, percent, 0);
+				fleet_shutdown(mins < 0 ? -1 : mins * 60);
+			}
+			suicide();
+		}
+		if (percent > prms.batmon && !opts.monitor) {
+			/* Only the wake alarm armed here wakes a machine that is
+			 * suspended on battery, so with it stay whatever the
+			 * charge, else back to cron or the daemon loop.
+			*/
+			if (!sg.alarm) break;
+			publish_status(ST_IDLE, &bs, minsleft, prms);
+		} else {
+			publish_status(ST_MONITOR, &bs, minsleft, prms);
 		}
-		if (monitor) {
-			fprintf(stdout, "Battery percentage: %d\n", percent);
+		if (opts.monitor) {
+			fprintf(stdout, "Battery percentage: %d%s", bs.percent,
+					bs.estimated ? " (estimated, read was late)" : "");
+			if (sc.percent >= 0) {
+				fprintf(stdout, ", by voltage: %d", sc.percent);
+			}
+			fputc('\n', stdout);
+			loadpred_t lp;
+			if (load_predict(&bs, prms.batquit, &lp) == 0) {
+				fprintf(stdout, "At this load %.1f W, %d minutes to"
+						" quit_level", lp.watts, lp.mins);
+				if (lp.cronjobs) {
+					fprintf(stdout, ", %d with %d cron jobs starting",
+							lp.cronmins, lp.cronjobs);
+				}
+				fputc('\n', stdout);
+			}
 		}
-		sleep(prms.interval);
-		sysbuf = readpseudofile(bat0, 's');
-		percent = strtol(sysbuf, NULL, 10);
-		sysbuf = readpseudofile(ac0, 'c');
-		poweroff = (sysbuf[0] == '0');
-	} // while(poweroff)
+		int fast = (bs.voltage > 0 && percent <= 2 * prms.batquit);
+		wait_for_change(&ufd, &sg, &bs, prms, opts.monitor, fast);
+		take_sample(&bs);
+		if (!bs.estimated) {
+			soc_update(&bs, &sc);
+			load_update(&bs);
+			suspend_account(&sg, bs.energy_now);
+			if (history_update(&bs)) check_wear(prms);
+		}
+	} // while(!bs.acon)
+	restore_battery_alarm();
+	suspend_close(&sg);
+	if (ufd != -1) close(ufd);
+	publish_status(ST_IDLE, &bs, -1, prms);
+	if (bs.acon) return resume_gate(prms.resdelay, prms.reslevel);
+	return 0;
 } // check_power_status()
 
-void check_set_config_values(int res, cfgprm *prms, cfgdata cd)
+int check_set_config_values(int res, cfgprm *prms, cfgdata cd)
 {
 	switch (res)
 	{
 		case 0:
 			prms->interval = strtol(cd.cfgval, NULL, 10);
-			sanity_check(prms->interval, 1, 8*60, "check_interval");
+			if (sanity_check(prms->interval, 1, 8*60,
+							"check_interval")) return -1;
 			prms->interval *= 60; // given in min., but I want secs.
 			break;
 		case 1:
 			prms->batmon = strtol(cd.cfgval, NULL, 10);
-			sanity_check(prms->batmon, 10, 100, "monitor_level");
+			if (sanity_check(prms->batmon, 10, 100,
+							"monitor_level")) return -1;
 			break;
 		case 2:
 			prms->batquit = strtol(cd.cfgval, NULL, 10);
-			sanity_check(prms->batquit, 1, 100, "quit_level");
+			if (sanity_check(prms->batquit, 1, 100,
+							"quit_level")) return -1;
+			break;
+		case 3:
+			prms->shutmins = strtol(cd.cfgval, NULL, 10);
+			if (sanity_check(prms->shutmins, 1, 60,
+							"shutdown_minutes")) return -1;
+			break;
+		case 4:
+			prms->grace = strtol(cd.cfgval, NULL, 10);
+			if (sanity_check(prms->grace, 0, 600,
+							"grace_seconds")) return -1;
+			break;
+		case 5:
+			prms->suspwake = strtol(cd.cfgval, NULL, 10);
+			if (sanity_check(prms->suspwake, 0, 1,
+							"suspend_wake")) return -1;
+			break;
+		case 6:
+			prms->resdelay = strtol(cd.cfgval, NULL, 10);
+			if (sanity_check(prms->resdelay, 0, 3600,
+							"resume_delay")) return -1;
+			break;
+		case 7:
+			prms->reslevel = strtol(cd.cfgval, NULL, 10);
+			if (sanity_check(prms->reslevel, 0, 100,
+							"resume_level")) return -1;
 			break;
 		default:
 			fprintf(stderr, "Unknown parameter name in config file:"
 					" %s\n", cd.cfgname);
-			exit(EXIT_FAILURE);
-			break;
+			return -1;
 	} // switch(res)
+	return 0;
 } // check_set_config_values()
 
 void get_cfg_name(char *src, char *name, const char sep)
@@ -264,3 +613,109 @@ static void strip_space(char *buf)
 	buf[len] = '\0';
 	free(target);
 } // strip_space()
+
+static void publish_status(int state, const batsample_t *bs, int minsleft,
+							cfgprm prms)
+{
+	status_t st;
+	st.pid = getpid();
+	st.sampled = bs->when;
+	st.acon = bs->acon;
+	st.percent = bs->percent;
+	st.state = state;
+	st.minsleft = minsleft;
+	st.batmon = prms.batmon;
+	st.batquit = prms.batquit;
+	st.interval = prms.interval;
+	st.sysmode = sysmode;
+	st.stalls = sampler_stalls();
+	st.estimated = bs->estimated;
+	loadpred_t lp;
+	load_predict(bs, prms.batquit, &lp);
+	st.loadmw = lp.watts * 1000;
+	st.loadmins = lp.mins;
+	st.cronmins = lp.cronmins;
+	st.cronjobs = lp.cronjobs;
+	status_publish(&st);
+} // publish_status()
+
+static int predict_minutes(int p0, time_t t0, int percent, int batquit)
+{	/* Linear drain since monitoring began, -1 until there is any. */
+	int used = p0 - percent;
+	time_t elapsed = time(NULL) - t0;
+	if (used <= 0 || elapsed <= 0) return -1;
+	if (percent <= batquit) return 0;
+	return (percent - batquit) * elapsed / used / 60;
+} // predict_minutes()
+
+static void check_wear(cfgprm prms)
+{	/* Called once a day. Fit the fall of energy_full and warn if in a
+	 * month quit_level will no longer leave shutdown_minutes of runtime
+	 * at the usual power draw on battery.
+	*/
+	wear_t w;
+	if (history_wear(&w) == -1 || w.power <= 0 || w.full <= 0) return;
+	double full = w.full + 30 * w.slope;
+	double mins = full * prms.batquit / 100 / w.power * 60;
+	if (mins >= prms.shutmins) return;
+	int need = 100.0 * prms.shutmins * w.power / 60 / full + 1;
+	fprintf(stderr, "Warning: battery wear. Full charge is now %.1f Wh",
+			w.full / 1e6);
+	if (w.design > 0) {
+		fprintf(stderr, " (%.0f%% of design)", 100 * w.full / w.design);
+	}
+	fprintf(stderr, ", changing by %.2f Wh per day.\n"
+			"In 30 days quit_level=%d will leave %.1f minutes at %.1f W,"
+			" less than shutdown_minutes=%d.\nConsider quit_level=%d.\n",
+			w.slope / 1e6, prms.batquit, mins, w.power / 1e6,
+			prms.shutmins, need);
+} // check_wear()
+
+static void wait_for_change(int *ufd, suspguard_t *sg, const batsample_t *bs,
+							cfgprm prms, int monitor, int fast)
+{	/* Between monitor_level and quit_level. Rather than wake every
+	 * check_interval, program the battery alarm to quit_level and sleep
+	 * until a power_supply uevent: the alarm, mains returning or any
+	 * other battery change. The caller samples again either way. If
+	 * there is no writable alarm, or in monitor mode, just poll.
+	 * If our wake alarm has just brought the machine out of suspend,
+	 * suspend it again until the next check, or hibernate if the drain
+	 * while suspended would reach quit_level before then. Near
+	 * quit_level, when voltage can be read, poll every SOC_FAST_SECS so
+	 * that a voltage cliff is caught in time. The alarm is then set to
+	 * twice quit_level, where that polling starts.
+	*/
+	long quit = (long long)bs->energy_full * prms.batquit / 100;
+	if (sg->ours && bs->energy_full > 0 && bs->energy_now > 0) {
+		int next = suspend_next(sg, bs->energy_now, quit, prms.interval);
+		if (next == 0) {
+			publish_status(ST_SHUTDOWN, bs, 0, prms);
+			if (consolekit("Hibernate boolean:true")) suicide();
+			return;
+		}
+		suspend_arm(sg, next, bs->energy_now);
+		consolekit("Suspend boolean:true");
+		wait_kickable(sg, *ufd);
+		return;
+	}
+	int secs = fast ? SOC_FAST_SECS : prms.interval;
+	int evfd = -1;
+	if (!monitor && !fast && bs->energy_full > 0) {
+		long alarm = (bs->voltage > 0) ? 2 * quit : quit;
+		if (bs->energy_now > alarm && set_battery_alarm(alarm) == 0) {
+			if (*ufd == -1) *ufd = uevent_open();
+			evfd = *ufd;
+			// in case the alarm never comes.
+			if (evfd != -1 && secs < 3600) secs = 3600;
+		}
+	}
+	suspend_arm(sg, secs, bs->energy_now);
+	wait_kickable(sg, evfd);
+} // wait_for_change()
+
+static void wait_kickable(suspguard_t *sg, int ufd)
+{	/* suspend_wait() that config_changed() can end early. */
+	__atomic_store_n(&waiting, sg, __ATOMIC_RELEASE);
+	suspend_wait(sg, ufd);
+	__atomic_store_n(&waiting, NULL, __ATOMIC_RELEASE);
+} // wait_kickable()
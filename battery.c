@@ -0,0 +1,164 @@
+/* battery.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "battery.h"
+
+/* On ACPI any read of BAT0 runs the firmware's _BST method, which may
+ * wait seconds on the embedded controller. So what never changes is
+ * read once, along with the first sample, on whichever thread takes it,
+ * the sampler's in the decision loop, and is then kept in memory.
+*/
+
+static long origalarm = -1;	// as found, before we first set it
+static batinfo_t info;
+static int infoset;		// info has been read
+static pthread_once_t infoonce = PTHREAD_ONCE_INIT;
+
+static void read_info(void);
+static void read_id(char *id, size_t size);
+static long read_energy(const char *what);
+static long read_power(void);
+
+int read_battery(batsample_t *bs)
+{	/* AC online and capacity must be readable, returns -1 if not. The
+	 * rest is optional. Safe to call from the sampler thread.
+	*/
+	pthread_once(&infoonce, read_info);
+	long acon = readsysval(PS_AC "online");
+	long percent = readsysval(PS_BAT "capacity");
+	if (acon == -1 || percent == -1) return -1;
+	bs->acon = (acon != 0);
+	bs->percent = percent;
+	bs->estimated = 0;
+	bs->when = time(NULL);
+	bs->energy_now = read_energy("now");
+	bs->energy_full = read_energy("full");
+	bs->energy_design = read_energy("full_design");
+	bs->power = read_power();
+	bs->voltage = readsysval(PS_BAT "voltage_now");
+	bs->current = readsysval(PS_BAT "current_now");
+	if (bs->current < -1) bs->current = -bs->current;
+	return 0;
+} // read_battery()
+
+const batinfo_t *battery_info(void)
+{	/* The fixed details, NULL until a sample has been read. */
+	return __atomic_load_n(&infoset, __ATOMIC_ACQUIRE) ? &info : NULL;
+} // battery_info()
+
+void battery_id(char *id, size_t size)
+{	/* model-serial, to tell one battery's learned data from another's. */
+	const batinfo_t *bi = battery_info();
+	if (!bi) {
+		read_id(id, size);
+		return;
+	}
+	strncpy(id, bi->id, size - 1);
+	id[size - 1] = '\0';
+} // battery_id()
+
+static void read_info(void)
+{
+	read_id(info.id, NAME_MAX);
+	info.vmin = readsysval(PS_BAT "voltage_min_design");
+	info.vmax = readsysval(PS_BAT "voltage_max_design");
+	info.alarm = readsysval(PS_BAT "alarm");
+	info.charge = (readsysval(PS_BAT "energy_now") == -1);
+	__atomic_store_n(&infoset, 1, __ATOMIC_RELEASE);
+} // read_info()
+
+static void read_id(char *id, size_t size)
+{	/* Only letters, digits, '-' and '_' are kept. */
+	char raw[2 * NAME_MAX] = "";
+	FILE *fpi = fopen(PS_BAT "model_name", "r");
+	if (fpi) {
+		if (!fgets(raw, NAME_MAX, fpi)) raw[0] = '\0';
+		fclose(fpi);
+	}
+	strcat(raw, "-");
+	fpi = fopen(PS_BAT "serial_number", "r");
+	if (fpi) {
+		size_t len = strlen(raw);
+		if (!fgets(raw + len, NAME_MAX, fpi)) raw[len] = '\0';
+		fclose(fpi);
+	}
+	size_t i, j = 0;
+	for (i = 0; raw[i] && j < size - 1; i++) {
+		if (isalnum(raw[i]) || raw[i] == '-' || raw[i] == '_') {
+			id[j++] = raw[i];
+		}
+	}
+	id[j] = '\0';
+} // read_id()
+
+int set_battery_alarm(long energy)
+{	/* Have the firmware raise a power_supply uevent when the remaining
+	 * energy, in uWh, falls to this. The alarm is in the battery's own
+	 * units, uAh for those that report charge. Returns -1 if there is
+	 * no alarm or we may not write it. Nothing is read here.
+	*/
+	const batinfo_t *bi = battery_info();
+	if (!bi || bi->alarm == -1) return -1;
+	if (bi->charge) {
+		if (bi->vmin <= 0) return -1;
+		energy = (long long)energy * 1000000 / bi->vmin;
+	}
+	FILE *fpo = fopen(PS_BAT "alarm", "w");
+	if (!fpo) return -1;
+	int res = fprintf(fpo, "%ld\n", energy);
+	if (fclose(fpo) == EOF || res < 0) return -1;
+	if (origalarm == -1) origalarm = bi->alarm;
+	return 0;
+} // set_battery_alarm()
+
+void restore_battery_alarm(void)
+{
+	if (origalarm == -1) return;
+	FILE *fpo = fopen(PS_BAT "alarm", "w");
+	if (!fpo) return;
+	fprintf(fpo, "%ld\n", origalarm);
+	fclose(fpo);
+	origalarm = -1;
+} // restore_battery_alarm()
+
+static long read_energy(const char *what)
+{	/* Some batteries report charge in uAh rather than energy in uWh,
+	 * convert those using the design voltage.
+	*/
+	char path[PATH_MAX];
+	sprintf(path, PS_BAT "energy_%s", what);
+	long val = readsysval(path);
+	if (val != -1) return val;
+	sprintf(path, PS_BAT "charge_%s", what);
+	val = readsysval(path);
+	if (val == -1 || info.vmin == -1) return -1;
+	return (long long)val * info.vmin / 1000000;
+} // read_energy()
+
+static long read_power(void)
+{
+	long val = readsysval(PS_BAT "power_now");
+	if (val != -1) return val;
+	long ua = readsysval(PS_BAT "current_now");
+	long uv = readsysval(PS_BAT "voltage_now");
+	if (ua == -1 || uv == -1) return -1;
+	if (ua < 0) ua = -ua;	// some drivers sign the discharge current
+	return (long long)ua * uv / 1000000;
+} // read_power()
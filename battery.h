@@ -0,0 +1,64 @@
+/*
+ * battery.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _BATTERY_H
+#define _BATTERY_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "fileops.h"
+
+#ifndef PS_AC
+#define PS_AC "/sys/class/power_supply/AC0/"
+#endif
+#ifndef PS_BAT
+#define PS_BAT "/sys/class/power_supply/BAT0/"
+#endif
+
+typedef struct batsample_t {
+	time_t when;
+	int acon;			// mains power online
+	int percent;		// battery charge %
+	long energy_now;	// uWh, -1 where the battery does not say
+	long energy_full;
+	long energy_design;
+	long power;			// uW
+	long voltage;		// uV
+	long current;		// uA, drawn or supplied
+	int estimated;		// the read was late, this is extrapolated
+} batsample_t;
+
+typedef struct batinfo_t {	// what does not change, read once
+	char id[NAME_MAX];	// model-serial, see battery_id()
+	long vmin;			// uV, voltage_min_design, -1 unknown
+	long vmax;			// uV, voltage_max_design, -1 unknown
+	long alarm;			// alarm as found, -1 if there is none
+	int charge;			// reports charge in uAh, not energy in uWh
+} batinfo_t;
+
+int read_battery(batsample_t *bs);
+const batinfo_t *battery_info(void);
+void battery_id(char *id, size_t size);
+int set_battery_alarm(long energy);
+void restore_battery_alarm(void);
+
+#endif
@@ -0,0 +1,91 @@
+/* countdown.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "countdown.h"
+
+static void broadcast(const char *msg);
+
+int countdown(int secs, int percent)
+{	/* Give mains power secs seconds to come back before shutdown.
+	 * Returns 1 if it did, and the shutdown is aborted, else 0.
+	 * A power_supply uevent wakes us at once, failing that mains is
+	 * read every CD_POLL_MS. The read is the sampler's, a late one
+	 * counts as mains still off.
+	*/
+	const int marks[] = { 60, 30, 10, 0 };	// reminders, seconds left
+	int mark = 0;
+	char msg[NAME_MAX];
+	sprintf(msg, "autosd: battery at %d%%, shutting down in %d seconds"
+			" unless mains power returns.", percent, secs);
+	broadcast(msg);
+	while (marks[mark] >= secs) mark++;
+	int ufd = uevent_open();
+	long end = clock_ms(CLOCK_MONOTONIC) + secs * 1000L;
+	long lastoff = clock_ms(CLOCK_MONOTONIC);	// mains last seen off
+	long event = 0;	// time of the first power_supply uevent since
+	while (1) {
+		long left = end - clock_ms(CLOCK_MONOTONIC);
+		if (left <= 0) break;
+		if (marks[mark] && left <= marks[mark] * 1000L) {
+			sprintf(msg, "autosd: shutting down in %d seconds unless"
+					" mains power returns.", marks[mark]);
+			broadcast(msg);
+			mark++;
+		}
+		if (uevent_wait(ufd, left < CD_POLL_MS ? left : CD_POLL_MS)
+			&& !event) event = clock_ms(CLOCK_MONOTONIC);
+		left = end - clock_ms(CLOCK_MONOTONIC);
+		if (sampler_acon(left < SAMPLE_DEADLINE_MS ? left
+							: SAMPLE_DEADLINE_MS) != 1) {
+			lastoff = clock_ms(CLOCK_MONOTONIC);
+			event = 0;	// not the event that matters
+			continue;
+		}
+		long aborted = clock_ms(CLOCK_MONOTONIC);
+		if (event) {
+			sprintf(msg, "autosd: mains power restored, shutdown aborted"
+					" %ld ms after the power_supply event.",
+					aborted - event);
+		} else {
+			sprintf(msg, "autosd: mains power restored, shutdown aborted"
+					" at most %ld ms after it returned.",
+					aborted - lastoff);
+		}
+		broadcast(msg);
+		if (ufd != -1) close(ufd);
+		return 1;
+	} // while(1)
+	if (ufd != -1) close(ufd);
+	return 0;
+} // countdown()
+
+static void broadcast(const char *msg)
+{	/* To stdout, every terminal and the desktop if there is one. Run
+	 * in the background so as not to slow the countdown.
+	*/
+	char command[3 * NAME_MAX];
+	fprintf(stdout, "%s\n", msg);
+	fflush(stdout);
+	sprintf(command, "(wall '%s'; notify-send -u critical autosd '%s')"
+			" >/dev/null 2>&1 &", msg, msg);
+	if (system(command) == -1) {
+		fprintf(stderr, "Command failed: %s\n", command);
+	}
+} // broadcast()
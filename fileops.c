@@ -20,6 +20,8 @@
 
 #include "fileops.h"
 
+static char **cfg_from_fd(int fd, const char *rpath);
+
 fdata readtextfile(const char *filename, off_t extra, int fatal)
 {	// checks that file terminates with '\n' if not appends it.
 	fdata txtdat = readfile(filename, extra + 1, fatal);
@@ -232,7 +234,9 @@ char *gettmpfn(void)
 
 char **readcfg(const char *relpath)
 {	// reads a config file; somevar=somevalue + comments '#'
-	char *rpath = get_realpath_home(relpath);
+	// relpath is relative to $HOME unless it begins with '/'.
+	const char *rpath = (relpath[0] == '/') ? relpath
+						: get_realpath_home(relpath);
 	fdata rcdat = readtextfile(rpath, 0, 1);
 	comment_text_to_space(rcdat.from, rcdat.to);
 	int lcount = count_cfg_data_lines(rcdat.from, rcdat.to);
@@ -242,6 +246,74 @@ char **readcfg(const char *relpath)
 	return retval;
 } // readcfg()
 
+char **trycfg(const char *relpath)
+{	/* As readcfg() but returns NULL, rather than quitting, if the file
+	 * can not be read or has a malformed line, which is reported.
+	*/
+	const char *rpath = (relpath[0] == '/') ? relpath
+						: get_realpath_home(relpath);
+	int fd = open(rpath, O_RDONLY);
+	if (fd == -1) return NULL;
+	return cfg_from_fd(fd, rpath);
+} // trycfg()
+
+char **trycfg_owned(const char *path, uid_t uid)
+{	/* As trycfg() for a file some other user controls: it must be a
+	 * regular file of uid's own, not reached through a symbolic link.
+	*/
+	int fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+	struct stat sb;
+	if (fd == -1 || fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)
+		|| sb.st_uid != uid) {
+		fprintf(stderr, "%s must be the user's own regular file.\n",
+				path);
+		if (fd != -1) close(fd);
+		return NULL;
+	}
+	return cfg_from_fd(fd, path);
+} // trycfg_owned()
+
+static char **cfg_from_fd(int fd, const char *rpath)
+{	/* The lines of the config open on fd, which is closed. A malformed
+	 * line is reported by number only, the file may not be ours to show.
+	*/
+	struct stat sb;
+	if (fstat(fd, &sb) == -1) {
+		close(fd);
+		return NULL;
+	}
+	char *from = docalloc(sb.st_size + 1, sizeof(char), "trycfg");
+	ssize_t got = read(fd, from, sb.st_size);
+	close(fd);
+	if (got < 0) got = 0;
+	from[got] = '\n';
+	char *to = from + got + 1;
+	comment_text_to_space(from, to);
+	// set_cfg_lines() and get_cfg_name() would quit on a bad line.
+	char *bol = from;
+	int lineno = 0;
+	while (bol < to) {
+		lineno++;
+		char *eol = memchr(bol, '\n', to - bol);
+		while (bol < eol && isspace(*bol)) bol++;
+		char *end = eol;
+		while (end > bol && isspace(end[-1])) end--;
+		size_t len = end - bol;
+		if (len && (len < 3 || len > NAME_MAX - 1
+			|| !memchr(bol, '=', len))) {
+			fprintf(stderr, "Invalid line %d in %s\n", lineno, rpath);
+			free(from);
+			return NULL;
+		}
+		bol = eol + 1;
+	}
+	int lcount = count_cfg_data_lines(from, to);
+	char **retval = docalloc(lcount+1, sizeof(char*), "trycfg");
+	set_cfg_lines(retval, lcount, from, to);
+	free(from);
+	return retval;
+} // cfg_from_fd()
+
 char *readpseudofile(const char *path, const char datatype)
 {
 	/*
@@ -282,6 +354,32 @@ char *readpseudofile(const char *path, const char datatype)
 	return retbuf;
 } // readpseudofile()
 
+long readsysval(const char *path)
+{	/* Read a numeric value from /sys or /proc. Unlike readpseudofile()
+	 * a missing or unreadable file is not an error, it returns -1.
+	*/
+	FILE *fpi = fopen(path, "r");
+	if (!fpi) return -1;
+	long val;
+	if (fscanf(fpi, "%ld", &val) != 1) val = -1;
+	fclose(fpi);
+	return val;
+} // readsysval()
+
+double readpressure(const char *what)
+{	/* The some avg10 of /proc/pressure/<what>, cpu, io or memory, as
+	 * a fraction. 0 where the kernel has no PSI.
+	*/
+	char path[PATH_MAX];
+	sprintf(path, "/proc/pressure/%s", what);
+	FILE *fpi = fopen(path, "r");
+	if (!fpi) return 0;
+	double avg10;
+	if (fscanf(fpi, "some avg10=%lf", &avg10) != 1) avg10 = 0;
+	fclose(fpi);
+	return avg10 / 100;
+} // readpressure()
+
 int dostat(const char *fn, struct stat *sb, int fatal)
 {
 	int res = stat(fn, sb);
@@ -333,6 +431,31 @@ char *get_realpath_home(const char *relpath)
 	return rpath;
 } // get_realpath_home()
 
+char *datadir_path(const char *dir, const char *name)
+{	/* name in dir, which is relative to $HOME unless it begins with
+	 * '/'. Like get_realpath_home() the result is a static buffer.
+	*/
+	static char path[PATH_MAX];
+	char rel[PATH_MAX];
+	sprintf(rel, "%s/%s", dir, name);
+	strcpy(path, (dir[0] == '/') ? rel : get_realpath_home(rel));
+	return path;
+} // datadir_path()
+
+int64_t clock_ns(clockid_t clk)
+{	/* clk now, for timing. CLOCK_MONOTONIC stops while suspended,
+	 * CLOCK_BOOTTIME does not.
+	*/
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} // clock_ns()
+
+long clock_ms(clockid_t clk)
+{
+	return clock_ns(clk) / 1000000;
+} // clock_ms()
+
 void comment_text_to_space(char *from, const char *to)
 {	// comments begin with '#' to end of line
 	char *cp = from;
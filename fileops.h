@@ -34,6 +34,8 @@
 #include <limits.h>
 #include <linux/limits.h>
 #include <libgen.h>
+#include <stdint.h>
+#include <time.h>
 
 #define _GNU_SOURCE 1
 
@@ -56,11 +58,18 @@ int getans(const char *prompt, const char *choices);
 int isrunning(char **proglist);
 char *gettmpfn(void);
 char **readcfg(const char *relpath);
+char **trycfg(const char *relpath);
+char **trycfg_owned(const char *path, uid_t uid);
 char *readpseudofile(const char *path, const char datatype);
+long readsysval(const char *path);
+double readpressure(const char *what);
 int dostat(const char *fn, struct stat *sb, int fatal);
 void *docalloc(size_t nmemb, size_t size, const char *func);
 size_t dofread(const char *fn, void *fro, size_t nbytes, FILE *fpi);
 char *get_realpath_home(const char *relpath);
+char *datadir_path(const char *dir, const char *name);
+int64_t clock_ns(clockid_t clk);
+long clock_ms(clockid_t clk);
 void comment_text_to_space(char *from, const char *to);
 int count_cfg_data_lines(char *from, char *to);
 void set_cfg_lines(char **lines, int numlines, char *from, char *to);
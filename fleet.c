@@ -0,0 +1,430 @@
+/* fleet.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "fleet.h"
+
+/* Several hosts on one UPS. The coordinator tells its peers to shut
+ * down one tier at a time, lowest tier number first, so that clients
+ * go before the servers they mount. The protocol is one line each way
+ * over TCP:
+ *	coordinator -> peer		SHUTDOWN <seconds> [key]
+ *	peer -> coordinator		ACK <hostname>
+ * The peer keeps the connection open while it shuts down, so end of
+ * file after the ACK tells the coordinator that the peer is gone.
+*/
+
+enum { P_CONNECT, P_SENT, P_ACKED, P_DOWN, P_FAILED };
+
+typedef struct peer_t {
+	int tier;
+	char host[NAME_MAX];
+	char port[NAME_MAX];
+	int fd;
+	struct addrinfo *ai;	// addresses for host:port
+	struct addrinfo *next;	// the one to try after the current
+	int state;
+	char buf[NAME_MAX];	// reply so far
+	size_t len;
+} peer_t;
+
+typedef struct fleet_t {
+	peer_t *peers;
+	int npeers;
+	int timeout;		// most seconds to wait on any tier
+	char key[NAME_MAX];	// shared secret, may be empty
+} fleet_t;
+
+static fleet_t fleet;	// read and checked by fleet_check()
+
+static int read_fleet(fleet_t *fl, int needed);
+static int set_peer(peer_t *pr, int tier, char *val);
+static int cmp_tier(const void *a, const void *b);
+static void run_tier(peer_t *pr, int n, int secs, const char *key);
+static void start_connect(peer_t *pr);
+static void next_address(peer_t *pr);
+static int listen_all(const char *port, struct pollfd *lfd, int max);
+static void peer_event(peer_t *pr, int secs, const char *key);
+static void report_tier(peer_t *pr, int n);
+static int read_line(int fd, char *buf, size_t size, int ms);
+
+void fleet_check(void)
+{	/* At startup, so that a missing or bad fleet.cfg is found then and
+	 * not when the battery is at quit_level.
+	*/
+	if (read_fleet(&fleet, 1) == -1) exit(EXIT_FAILURE);
+} // fleet_check()
+
+void fleet_shutdown(int budget)
+{	/* Shut the peers down tier by tier within budget seconds, leaving
+	 * FLEET_RESERVE seconds for ourselves. A budget of -1 means the
+	 * runtime is not known. Never quits, our own shutdown follows.
+	*/
+	fleet_t fl = fleet;
+	if (!fl.peers) {
+		fputs("No fleet config was read, no peers told.\n", stderr);
+		return;
+	}
+	qsort(fl.peers, fl.npeers, sizeof(peer_t), cmp_tier);
+	int ntiers = 0;
+	int i;
+	for (i = 0; i < fl.npeers; i++) {
+		if (i == 0 || fl.peers[i].tier != fl.peers[i-1].tier) ntiers++;
+	}
+	if (budget < 0) {	// no prediction yet, allow every tier in full
+		budget = ntiers * fl.timeout + FLEET_RESERVE;
+	}
+	time_t end = time(NULL) + budget - FLEET_RESERVE;
+	i = 0;
+	while (i < fl.npeers) {
+		int j = i;
+		while (j < fl.npeers && fl.peers[j].tier == fl.peers[i].tier) j++;
+		int secs = (end - time(NULL)) / ntiers;
+		if (secs > fl.timeout) secs = fl.timeout;
+		if (secs < 1) secs = 1;	// over budget, still tell them.
+		run_tier(&fl.peers[i], j - i, secs, fl.key);
+		report_tier(&fl.peers[i], j - i);
+		ntiers--;
+		i = j;
+	}
+} // fleet_shutdown()
+
+void fleet_listen(const char *port, void (*shutdown)(void), int dryrun)
+{	/* Peer side: wait for a coordinator to tell us to shut down. */
+	fleet_t fl = { 0 };
+	if (read_fleet(&fl, 0) == -1) exit(EXIT_FAILURE);
+	free(fl.peers);
+	struct pollfd lfd[FLEET_LISTEN_MAX];
+	int nl = listen_all(port, lfd, FLEET_LISTEN_MAX);
+	char host[NAME_MAX];
+	if (gethostname(host, NAME_MAX) == -1) strcpy(host, "unknown");
+	while (1) {
+		if (poll(lfd, nl, -1) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll()");
+			exit(EXIT_FAILURE);
+		}
+		int i, cfd = -1;
+		for (i = 0; i < nl && cfd == -1; i++) {
+			if (lfd[i].revents & POLLIN) cfd = accept(lfd[i].fd, NULL, NULL);
+		}
+		if (cfd == -1) continue;
+		char line[NAME_MAX];
+		char key[NAME_MAX] = "";
+		int secs;
+		if (read_line(cfd, line, NAME_MAX, 5000) == -1
+			|| sscanf(line, "SHUTDOWN %d %254s", &secs, key) < 1
+			|| strcmp(key, fl.key) != 0) {
+			close(cfd);	// not for us
+			continue;
+		}
+		char reply[2 * NAME_MAX];
+		sprintf(reply, "ACK %s\n", host);
+		if (send(cfd, reply, strlen(reply), MSG_NOSIGNAL) == -1) {
+			close(cfd);
+			continue;
+		}
+		fprintf(stdout, "Shutdown requested by coordinator, %d seconds"
+				" allowed.\n", secs);
+		fflush(stdout);
+		shutdown();
+		// Outside a dry run the connection is left for the kernel to
+		// close as the host goes down; that end of file is what tells
+		// the coordinator we are gone.
+		if (dryrun) close(cfd);
+	} // while(1)
+} // fleet_listen()
+
+static int listen_all(const char *port, struct pollfd *lfd, int max)
+{	/* Listen on every passive address for port, both IPv4 and IPv6
+	 * where the host has them. Returns how many, quits if none.
+	*/
+	struct addrinfo hints = { 0 };
+	struct addrinfo *res, *ai;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int err = getaddrinfo(NULL, port, &hints, &res);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", port, gai_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	int n = 0;
+	for (ai = res; ai && n < max; ai = ai->ai_next) {
+		int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd == -1) continue;
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		// Else :: takes the IPv4 port as well and 0.0.0.0 can't bind.
+		if (ai->ai_family == AF_INET6) {
+			setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+		}
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0
+			&& listen(fd, 8) == 0) {
+			lfd[n].fd = fd;
+			lfd[n].events = POLLIN;
+			n++;
+		} else {
+			close(fd);
+		}
+	}
+	freeaddrinfo(res);
+	if (!n) {
+		perror(port);
+		exit(EXIT_FAILURE);
+	}
+	return n;
+} // listen_all()
+
+static int read_fleet(fleet_t *fl, int needed)
+{	/* fleet.cfg lines are tier<N>=host:port, tier_timeout=<secs> and
+	 * key=<secret>. Only the coordinator, needed, must have the file.
+	 * Returns -1, having said why, if it is missing or malformed.
+	*/
+	fl->timeout = 60;
+	if (!needed && fileexists(get_realpath_home(FLEET_CFG)) == -1) {
+		return 0;
+	}
+	char **lines = trycfg(FLEET_CFG);
+	if (!lines) {
+		fprintf(stderr, "Can not use fleet config %s\n",
+				get_realpath_home(FLEET_CFG));
+		return -1;
+	}
+	int n = 0;
+	while (lines[n]) n++;
+	fl->peers = docalloc(n + 1, sizeof(peer_t), "read_fleet");
+	int i, bad = 0;
+	for (i = 0; i < n; i++) {
+		char *val = strchr(lines[i], '=');	// trycfg() saw it is there
+		*val = '\0';
+		val++;
+		while (isspace(*val)) val++;
+		if (bad) {
+			;	// just free the rest
+		} else if (strcmp(lines[i], "tier_timeout") == 0) {
+			fl->timeout = strtol(val, NULL, 10);
+			if (fl->timeout < 1) {
+				fputs("Insane value for 'tier_timeout' in fleet"
+						" config.\n", stderr);
+				bad = 1;
+			}
+		} else if (strcmp(lines[i], "key") == 0) {
+			strncpy(fl->key, val, NAME_MAX - 1);
+		} else if (strncmp(lines[i], "tier", 4) == 0
+					&& isdigit(lines[i][4])) {
+			if (set_peer(&fl->peers[fl->npeers],
+						strtol(lines[i] + 4, NULL, 10), val) == -1) {
+				bad = 1;
+			}
+			fl->npeers++;
+		} else {
+			fprintf(stderr, "Unknown parameter name in fleet config:"
+					" %s\n", lines[i]);
+			bad = 1;
+		}
+		free(lines[i]);
+	}
+	free(lines);
+	if (bad) {
+		free(fl->peers);
+		fl->peers = NULL;
+		fl->npeers = 0;
+		return -1;
+	}
+	return 0;
+} // read_fleet()
+
+static int set_peer(peer_t *pr, int tier, char *val)
+{	// val is host:port, or [v6addr]:port
+	char *colon = strrchr(val, ':');
+	if (!colon) {
+		fprintf(stderr, "Peer must be host:port, got %s\n", val);
+		return -1;
+	}
+	*colon = '\0';
+	if (*val == '[' && colon[-1] == ']') {
+		val++;
+		colon[-1] = '\0';
+	}
+	pr->tier = tier;
+	strncpy(pr->host, val, NAME_MAX - 1);
+	strncpy(pr->port, colon + 1, NAME_MAX - 1);
+	pr->fd = -1;
+	return 0;
+} // set_peer()
+
+static int cmp_tier(const void *a, const void *b)
+{
+	return ((const peer_t *)a)->tier - ((const peer_t *)b)->tier;
+} // cmp_tier()
+
+static void run_tier(peer_t *pr, int n, int secs, const char *key)
+{	/* Talk to every peer of the tier at once and collect all the ACKs
+	 * in one poll() loop until each is down or the time is up.
+	*/
+	struct pollfd *pfd = docalloc(n, sizeof(struct pollfd), "run_tier");
+	int i;
+	for (i = 0; i < n; i++) start_connect(&pr[i]);
+	long end = clock_ms(CLOCK_MONOTONIC) + secs * 1000L;
+	while (1) {
+		int busy = 0;
+		for (i = 0; i < n; i++) {
+			pfd[i].fd = -1;
+			pfd[i].revents = 0;
+			if (pr[i].state == P_DOWN || pr[i].state == P_FAILED) continue;
+			pfd[i].fd = pr[i].fd;
+			pfd[i].events = (pr[i].state == P_CONNECT) ? POLLOUT : POLLIN;
+			busy++;
+		}
+		long left = end - clock_ms(CLOCK_MONOTONIC);
+		if (!busy || left <= 0) break;
+		int res = poll(pfd, n, left);
+		if (res == -1 && errno != EINTR) {
+			perror("poll()");
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (pfd[i].fd != -1 && pfd[i].revents) {
+				peer_event(&pr[i], secs, key);
+			}
+		}
+	} // while(1)
+	for (i = 0; i < n; i++) {
+		if (pr[i].fd != -1) close(pr[i].fd);
+		pr[i].fd = -1;
+		if (pr[i].ai) freeaddrinfo(pr[i].ai);
+		pr[i].ai = NULL;
+	}
+	free(pfd);
+} // run_tier()
+
+static void start_connect(peer_t *pr)
+{
+	struct addrinfo hints = { 0 };
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	pr->state = P_FAILED;
+	pr->ai = NULL;
+	if (getaddrinfo(pr->host, pr->port, &hints, &pr->ai)) {
+		pr->ai = NULL;
+		return;
+	}
+	pr->next = pr->ai;
+	next_address(pr);
+} // start_connect()
+
+static void next_address(peer_t *pr)
+{	/* Connect to the peer's next address, as a host may be reachable
+	 * on only some of them. P_FAILED once all have been tried.
+	*/
+	if (pr->fd != -1) close(pr->fd);
+	pr->fd = -1;
+	pr->state = P_FAILED;
+	while (pr->next) {
+		struct addrinfo *ai = pr->next;
+		pr->next = ai->ai_next;
+		pr->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK,
+						ai->ai_protocol);
+		if (pr->fd == -1) continue;
+		if (connect(pr->fd, ai->ai_addr, ai->ai_addrlen) == 0
+			|| errno == EINPROGRESS) {
+			pr->state = P_CONNECT;
+			return;
+		}
+		close(pr->fd);
+		pr->fd = -1;
+	}
+} // next_address()
+
+static void peer_event(peer_t *pr, int secs, const char *key)
+{
+	if (pr->state == P_CONNECT) {
+		int err = 0;
+		socklen_t elen = sizeof(err);
+		getsockopt(pr->fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+		if (err) {
+			next_address(pr);
+			return;
+		}
+		char msg[2 * NAME_MAX];
+		sprintf(msg, "SHUTDOWN %d %s\n", secs, key);
+		if (send(pr->fd, msg, strlen(msg), MSG_NOSIGNAL) == -1) {
+			pr->state = P_FAILED;
+		} else {
+			pr->state = P_SENT;
+		}
+		return;
+	}
+	ssize_t got = read(pr->fd, pr->buf + pr->len,
+						NAME_MAX - 1 - pr->len);
+	if (got == -1 && errno == EAGAIN) return;
+	if (got <= 0) {	// peer closed, gone down if it said so first
+		pr->state = (pr->state == P_ACKED) ? P_DOWN : P_FAILED;
+		return;
+	}
+	pr->len += got;
+	pr->buf[pr->len] = '\0';
+	if (pr->state == P_SENT && strchr(pr->buf, '\n')) {
+		pr->state = (strncmp(pr->buf, "ACK ", 4) == 0) ? P_ACKED
+														: P_FAILED;
+	}
+	if (pr->len == NAME_MAX - 1) pr->len = 0;	// junk after the ACK
+} // peer_event()
+
+static void report_tier(peer_t *pr, int n)
+{	/* One line per tier rather than one per acknowledgement. */
+	int down = 0, acked = 0, failed = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		if (pr[i].state == P_DOWN) down++;
+		else if (pr[i].state == P_ACKED) acked++;
+		else failed++;
+	}
+	fprintf(stdout, "Tier %d: %d down, %d acknowledged, %d no answer",
+			pr->tier, down, acked, failed);
+	for (i = 0; i < n; i++) {
+		if (pr[i].state != P_DOWN && pr[i].state != P_ACKED) {
+			fprintf(stdout, " %s:%s", pr[i].host, pr[i].port);
+		}
+	}
+	fputc('\n', stdout);
+	fflush(stdout);
+} // report_tier()
+
+static int read_line(int fd, char *buf, size_t size, int ms)
+{	/* Read one '\n' terminated line within ms milliseconds. */
+	size_t len = 0;
+	long end = clock_ms(CLOCK_MONOTONIC) + ms;
+	while (len < size - 1) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		long left = end - clock_ms(CLOCK_MONOTONIC);
+		if (left <= 0 || poll(&pfd, 1, left) != 1) return -1;
+		ssize_t got = read(fd, buf + len, size - 1 - len);
+		if (got <= 0) return -1;
+		len += got;
+		buf[len] = '\0';
+		char *eol = strchr(buf, '\n');
+		if (eol) {
+			*eol = '\0';
+			return 0;
+		}
+	}
+	return -1;
+} // read_line()
@@ -0,0 +1,45 @@
+/*
+ * fleet.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _FLEET_H
+#define _FLEET_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "fileops.h"
+
+#define FLEET_CFG ".config/autosd/fleet.cfg"
+#define FLEET_RESERVE 30	// seconds kept back for our own shutdown
+#define FLEET_LISTEN_MAX 8	// passive addresses listened on
+
+void fleet_check(void);
+void fleet_shutdown(int budget);
+void fleet_listen(const char *port, void (*shutdown)(void), int dryrun);
+
+#endif
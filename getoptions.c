@@ -22,6 +22,7 @@
 
 static const char helpmsg[] =
   "\tUsage: autosd [option]\n"
+  "\t       autosd [-r n] measure -- command [arg ...]\n"
   "\tNB on first run a file, 'autosd.cfg' is installed at "
   "$HOME/.config/autosd/.\n"
 
@@ -30,13 +31,43 @@ static const char helpmsg[] =
   "\t-m, --monitor\n"
   "\t prints stats when running off battery so as to help choose the"
   " best\n\tparameters in the config file. \n"
+  "\t-c, --coordinate\n"
+  "\t before shutting down, shut down the peers listed in fleet.cfg"
+  " tier by tier.\n\t With -n do it at once, then quit, to try the fleet"
+  " out.\n"
+  "\t-d, --daemon\n"
+  "\t run as the one system wide instance, using /etc/autosd.conf and"
+  "\n\t users' own autosd.cfg, instead of per user cron jobs.\n"
+  "\t-H, --history minute|hour|day\n"
+  "\t prints the battery history archive at that resolution, then"
+  " quits.\n"
+  "\t-l, --listen port\n"
+  "\t wait on port for a coordinator to request shutdown.\n"
+  "\t-n, --dry-run\n"
+  "\t print the shutdown command instead of running it.\n"
+  "\t-o, --output file\n"
+  "\t the file --profile-power writes its samples to, default "
+  "autosd-power.bin.\n"
+  "\t-p, --profile-power Hz\n"
+  "\t sample battery power at up to 100 Hz until interrupted, then"
+  " print\n\t mean, p50, p99 and the energy used.\n"
+  "\t-r, --repeat n\n"
+  "\t run the measured command n times, default 1.\n"
+  "\t-s, --status\n"
+  "\t prints the status published by the running instance, then quits."
+  "\n"
+  "\t-t, --time seconds\n"
+  "\t stop --profile-power after this many seconds.\n"
+  "\t-w, --wait-resume\n"
+  "\t after a power outage, return when the resume gate lets this job"
+  " go.\n"
   ;
 
 options_t
 process_options(int argc, char **argv)
 {
 
-	static const char optstr[] = ":hm";
+	static const char optstr[] = ":cdhH:l:mno:p:r:st:w";
 
 	options_t opts = { 0 };
 
@@ -46,8 +77,19 @@ process_options(int argc, char **argv)
 		int this_option_optind = optind ? optind : 1;
 		int option_index = 0;
 		static struct option long_options[] = {
+			{"coordinate",	0,	0,	'c'},
+			{"daemon",	0,	0,	'd'},
 			{"help", 0,	0,	'h' },
+			{"history",	1,	0,	'H'},
+			{"listen",	1,	0,	'l'},
 			{"monitor",	0,	0,	'm'},
+			{"dry-run",	0,	0,	'n'},
+			{"output",	1,	0,	'o'},
+			{"profile-power",	1,	0,	'p'},
+			{"repeat",	1,	0,	'r'},
+			{"status",	0,	0,	's'},
+			{"time",	1,	0,	't'},
+			{"wait-resume",	0,	0,	'w'},
 			{0,	0,	0,	0 }
 		};
 
@@ -60,12 +102,53 @@ process_options(int argc, char **argv)
 				switch (option_index) {
 				} // switch(option_index)
 				break;
+			case 'c':
+				opts.coordinate = 1;
+				break;
+			case 'd':
+				opts.daemon = 1;
+				break;
 			case 'h':
 				dohelp(0);
 				break;
+			case 'H':
+				opts.history = optarg;
+				break;
+			case 'l':
+				opts.listen = optarg;
+				break;
 			case 'm':
 				opts.monitor = 1;
 				break;
+			case 'n':
+				opts.dryrun = 1;
+				break;
+			case 'o':
+				opts.output = optarg;
+				break;
+			case 'p':
+				opts.profile = strtol(optarg, NULL, 10);
+				if (opts.profile < 1) {
+					fprintf(stderr, "Bad profile rate: %s\n", optarg);
+					dohelp(1);
+				}
+				break;
+			case 'r':
+				opts.repeat = strtol(optarg, NULL, 10);
+				if (opts.repeat < 1) {
+					fprintf(stderr, "Bad repeat count: %s\n", optarg);
+					dohelp(1);
+				}
+				break;
+			case 's':
+				opts.status = 1;
+				break;
+			case 't':
+				opts.seconds = strtol(optarg, NULL, 10);
+				break;
+			case 'w':
+				opts.waitresume = 1;
+				break;
 			case ':':
 				fprintf(stderr, "Option %s requires an argument\n",
 							argv[this_option_optind]);
@@ -79,6 +162,18 @@ process_options(int argc, char **argv)
 		}
 
 	} // while(1)
+
+	if (optind < argc) {	// the measure subcommand
+		if (strcmp(argv[optind], "measure") != 0) {
+			fprintf(stderr, "Unknown argument: %s\n", argv[optind]);
+			dohelp(1);
+		}
+		if (optind + 1 == argc) {
+			fputs("measure needs a command to run\n", stderr);
+			dohelp(1);
+		}
+		opts.measure = &argv[optind + 1];
+	}
 	return opts;
 } // process_options()
 
@@ -36,6 +36,18 @@
 /* user declarations */
 typedef struct options_ {
 int monitor;
+int status;
+int coordinate;
+int dryrun;
+int daemon;
+char *listen;
+char *history;
+int profile;
+char *output;
+int seconds;
+char **measure;
+int repeat;
+int waitresume;
 } options_t;
 
 void dohelp(int forced);
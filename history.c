@@ -0,0 +1,296 @@
+/* history.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "history.h"
+
+/* A round robin database in the spirit of rrdtool. The file has a fixed
+ * size: one archive each of minute, hour and day rows. A row's slot is
+ * its start time divided by the step, modulo the number of rows, so an
+ * update never moves anything and stale slots are known by their start
+ * time. Samples are summed into a pending row per archive which is
+ * written out when a sample arrives for the next step.
+*/
+
+#define HIST_MAGIC 0x48445341	// "ASDH"
+
+typedef struct hrow_t {
+	time_t start;	// 0 while the slot is unused
+	double percent;
+	double energy_now;	// uWh, -1 unknown
+	double energy_full;
+	double energy_design;
+	double power;	// mean uW drawn on battery, 0 if never on battery
+} hrow_t;
+
+typedef struct hpend_t {
+	time_t start;
+	int n, nenergy, npower;
+	double percent, energy_now, energy_full, energy_design, power;
+} hpend_t;
+
+typedef struct harch_t {
+	int step;
+	int rows;
+	size_t offset;	// of the first row from the start of file
+	hpend_t pend;
+} harch_t;
+
+typedef struct hhead_t {
+	unsigned magic;
+	harch_t arch[HR_COUNT];
+} hhead_t;
+
+static const int steps[HR_COUNT] = { 60, 3600, 86400 };
+static const int nrows[HR_COUNT] = { 1440, 62 * 24, 3 * 365 };
+static const char *resnames[HR_COUNT] = { "minute", "hour", "day" };
+
+static const char *histpath = HIST_FILE;
+
+static hhead_t *open_history(int writing, int *fd, size_t *size);
+static void close_history(hhead_t *hh, int fd, size_t size);
+static int consolidate(hhead_t *hh, int arch, const batsample_t *bs);
+static void pend_to_row(const hpend_t *pd, hrow_t *row);
+static hrow_t *rows_of(hhead_t *hh, int arch);
+static void print_row(const hrow_t *row);
+
+void history_file(const char *path)
+{	// use path, relative to $HOME unless it begins with '/'.
+	histpath = path;
+} // history_file()
+
+int history_update(const batsample_t *bs)
+{	/* O(1) per sample. Returns 1 when a day row was written. */
+	int fd;
+	size_t size;
+	hhead_t *hh = open_history(1, &fd, &size);
+	if (!hh) return 0;
+	int i, newday = 0;
+	for (i = 0; i < HR_COUNT; i++) {
+		if (consolidate(hh, i, bs) && i == HR_DAY) newday = 1;
+	}
+	close_history(hh, fd, size);
+	return newday;
+} // history_update()
+
+int history_wear(wear_t *w)
+{	/* Least squares fit of energy_full over the day rows. Returns -1
+	 * until there are two days with energy data.
+	*/
+	int fd;
+	size_t size;
+	hhead_t *hh = open_history(0, &fd, &size);
+	if (!hh) return -1;
+	memset(w, 0, sizeof(wear_t));
+	hrow_t *rows = rows_of(hh, HR_DAY);
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	time_t latest = 0;
+	int i;
+	for (i = 0; i < hh->arch[HR_DAY].rows; i++) {
+		if (!rows[i].start || rows[i].energy_full <= 0) continue;
+		double x = rows[i].start / 86400;
+		double y = rows[i].energy_full;
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+		w->days++;
+		if (rows[i].start > latest) {
+			latest = rows[i].start;
+			w->full = y;
+			w->design = rows[i].energy_design;
+		}
+	}
+	double den = w->days * sxx - sx * sx;
+	if (w->days >= 2 && den != 0) {
+		w->slope = (w->days * sxy - sx * sy) / den;
+	}
+	rows = rows_of(hh, HR_HOUR);
+	int np = 0;
+	for (i = 0; i < hh->arch[HR_HOUR].rows; i++) {
+		if (!rows[i].start || rows[i].power <= 0) continue;
+		w->power += rows[i].power;
+		np++;
+	}
+	if (np) w->power /= np;
+	close_history(hh, fd, size);
+	return (w->days >= 2) ? 0 : -1;
+} // history_wear()
+
+int history_show(const char *res)
+{	/* Print one archive oldest first, reading only its own rows. */
+	int arch;
+	for (arch = 0; arch < HR_COUNT; arch++) {
+		if (strcmp(res, resnames[arch]) == 0) break;
+	}
+	if (arch == HR_COUNT) {
+		fprintf(stderr, "History resolution must be minute, hour or"
+				" day, not %s\n", res);
+		return 1;
+	}
+	int fd;
+	size_t size;
+	hhead_t *hh = open_history(0, &fd, &size);
+	if (!hh) {
+		fputs("No history has been recorded.\n", stdout);
+		return 1;
+	}
+	harch_t *a = &hh->arch[arch];
+	hrow_t *rows = rows_of(hh, arch);
+	time_t now = time(NULL);
+	time_t oldest = now - now % a->step - (time_t)a->rows * a->step;
+	fputs("time              percent  energy Wh  full Wh  health%  "
+			"battery W\n", stdout);
+	int i;
+	for (i = 1; i <= a->rows; i++) {
+		hrow_t *row = &rows[(now / a->step + i) % a->rows];
+		if (row->start > oldest) print_row(row);
+	}
+	if (a->pend.n) {	// the step still being summed
+		hrow_t row;
+		pend_to_row(&a->pend, &row);
+		print_row(&row);
+	}
+	close_history(hh, fd, size);
+	return 0;
+} // history_show()
+
+static hhead_t *open_history(int writing, int *fd, size_t *size)
+{	/* Map the whole file, creating it on first use. The lock keeps
+	 * overlapping cron runs from updating it together.
+	*/
+	const char *path = (histpath[0] == '/') ? histpath
+						: get_realpath_home(histpath);
+	*size = sizeof(hhead_t);
+	int i;
+	for (i = 0; i < HR_COUNT; i++) *size += nrows[i] * sizeof(hrow_t);
+	*fd = open(path, writing ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (*fd == -1) return NULL;
+	struct stat sb;
+	if (flock(*fd, writing ? LOCK_EX : LOCK_SH) == -1
+		|| fstat(*fd, &sb) == -1) {
+		close(*fd);
+		return NULL;
+	}
+	int fresh = ((size_t)sb.st_size != *size);
+	if (fresh && (!writing || ftruncate(*fd, 0) == -1
+					|| ftruncate(*fd, *size) == -1)) {
+		close(*fd);
+		return NULL;
+	}
+	hhead_t *hh = mmap(NULL, *size, writing ? PROT_READ | PROT_WRITE
+						: PROT_READ, MAP_SHARED, *fd, 0);
+	if (hh == MAP_FAILED) {
+		close(*fd);
+		return NULL;
+	}
+	if (hh->magic != HIST_MAGIC) {
+		if (!writing) {
+			close_history(hh, *fd, *size);
+			return NULL;
+		}
+		size_t offset = sizeof(hhead_t);
+		for (i = 0; i < HR_COUNT; i++) {
+			hh->arch[i].step = steps[i];
+			hh->arch[i].rows = nrows[i];
+			hh->arch[i].offset = offset;
+			offset += nrows[i] * sizeof(hrow_t);
+		}
+		hh->magic = HIST_MAGIC;
+	}
+	return hh;
+} // open_history()
+
+static void close_history(hhead_t *hh, int fd, size_t size)
+{
+	munmap(hh, size);
+	close(fd);	// also drops the lock
+} // close_history()
+
+static int consolidate(hhead_t *hh, int arch, const batsample_t *bs)
+{	/* Add a sample to the archive's pending row, first writing that
+	 * row to its slot if the sample belongs to a later step.
+	*/
+	harch_t *a = &hh->arch[arch];
+	hpend_t *pd = &a->pend;
+	time_t start = bs->when - bs->when % a->step;
+	int written = 0;
+	if (pd->n && pd->start != start) {
+		pend_to_row(pd, &rows_of(hh, arch)[(pd->start / a->step)
+											% a->rows]);
+		memset(pd, 0, sizeof(hpend_t));
+		written = 1;
+	}
+	pd->start = start;
+	pd->n++;
+	pd->percent += bs->percent;
+	if (bs->energy_now >= 0 && bs->energy_full > 0) {
+		pd->nenergy++;
+		pd->energy_now += bs->energy_now;
+		pd->energy_full += bs->energy_full;
+		pd->energy_design += bs->energy_design;
+	}
+	if (!bs->acon && bs->power > 0) {
+		pd->npower++;
+		pd->power += bs->power;
+	}
+	return written;
+} // consolidate()
+
+static void pend_to_row(const hpend_t *pd, hrow_t *row)
+{
+	row->start = pd->start;
+	row->percent = pd->percent / pd->n;
+	row->energy_now = row->energy_full = row->energy_design = -1;
+	if (pd->nenergy) {
+		row->energy_now = pd->energy_now / pd->nenergy;
+		row->energy_full = pd->energy_full / pd->nenergy;
+		row->energy_design = pd->energy_design / pd->nenergy;
+	}
+	row->power = pd->npower ? pd->power / pd->npower : 0;
+} // pend_to_row()
+
+static hrow_t *rows_of(hhead_t *hh, int arch)
+{
+	return (hrow_t *)((char *)hh + hh->arch[arch].offset);
+} // rows_of()
+
+static void print_row(const hrow_t *row)
+{
+	char when[NAME_MAX];
+	strftime(when, NAME_MAX, "%Y-%m-%d %H:%M", localtime(&row->start));
+	fprintf(stdout, "%s %7.1f", when, row->percent);
+	if (row->energy_full > 0) {
+		fprintf(stdout, " %10.2f %8.2f", row->energy_now / 1e6,
+				row->energy_full / 1e6);
+		if (row->energy_design > 0) {
+			fprintf(stdout, " %8.1f",
+					100 * row->energy_full / row->energy_design);
+		} else {
+			fputs("        -", stdout);
+		}
+	} else {
+		fputs("          -        -        -", stdout);
+	}
+	if (row->power > 0) {
+		fprintf(stdout, " %10.2f\n", row->power / 1e6);
+	} else {
+		fputs("          -\n", stdout);
+	}
+} // print_row()
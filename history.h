@@ -0,0 +1,52 @@
+/*
+ * history.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _HISTORY_H
+#define _HISTORY_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include "fileops.h"
+#include "battery.h"
+
+#define HIST_FILE ".config/autosd/history.rrd"
+
+enum { HR_MINUTE, HR_HOUR, HR_DAY, HR_COUNT };
+
+typedef struct wear_t {
+	int days;		// daily rows the trend is fitted to
+	double full;	// latest energy_full, uWh
+	double design;	// energy_full_design, uWh
+	double slope;	// change in energy_full per day, uWh
+	double power;	// mean power drawn on battery, uW, 0 unknown
+} wear_t;
+
+void history_file(const char *path);
+int history_update(const batsample_t *bs);
+int history_wear(wear_t *w);
+int history_show(const char *res);
+
+#endif
@@ -0,0 +1,446 @@
+/* load.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "load.h"
+
+/* Drain depends on what the machine is doing, idle to a build can be
+ * four times the power. Each sample on battery pairs the power drawn
+ * with the load: CPU busy fraction from /proc/stat, the PSI some avg10
+ * pressures for cpu, io and memory, and the number of populated
+ * cgroups. A linear model of power on those is fitted by recursive
+ * least squares with forgetting, a fixed amount of work per sample
+ * whatever the history, and kept in load.model beside the soc curve.
+ *
+ * Cron jobs are read from the crontab, or /etc/crontab and /etc/cron.d
+ * for the system daemon. A job is taken to add one busy CPU and one
+ * cgroup for LOAD_JOB_MINS after it starts, which is crude but leans
+ * the right way: runtime is predicted minute by minute with the jobs
+ * due, as well as at today's load.
+*/
+
+#define MODEL_MAGIC 0x4c444f4d	// "MODL"
+
+typedef struct model_t {
+	unsigned magic;
+	long n;					// samples learned from
+	double theta[LOAD_FEATURES];	// W per unit of each feature
+	double p[LOAD_FEATURES][LOAD_FEATURES];	// inverse covariance
+} model_t;
+
+typedef struct cronjob_t {
+	uint64_t min;		// bit per minute
+	uint32_t hour;
+	uint32_t dom;		// bits 1 to 31
+	uint32_t mon;		// bits 1 to 12
+	uint32_t dow;		// bits 0 to 6, Sunday 0
+	int domstar, dowstar;	// field was '*'
+} cronjob_t;
+
+static const char *datadir = ".config/autosd";
+static int syscrontab;
+static model_t model;
+static int loaded;
+static double feat[LOAD_FEATURES];	// the load at the last sample
+static int havefeat;
+static cronjob_t jobs[LOAD_MAX_JOBS];
+static int njobs;
+static time_t cronread;
+static int cgcount;
+
+static void load_model(void);
+static void save_model(void);
+static int sample_load(double *x);
+static double cpu_busy(void);
+static int read_cpu(long long *busy, long long *total);
+static int count_cgroups(void);
+static int cg_visit(const char *path, const struct stat *sb, int type,
+					struct FTW *ftw);
+static void learn(const double *x, double y);
+static double model_watts(const double *x);
+static void read_crontabs(void);
+static void read_crontab(FILE *fpi, int userfield);
+static int parse_job(char *line, int userfield, cronjob_t *job);
+static int parse_field(const char *s, int lo, int hi,
+						const char *const *names, uint64_t *bits);
+static int job_due(const cronjob_t *job, const struct tm *tm);
+
+void load_dir(const char *dir, int syscron)
+{	/* Where load.model is kept, relative to $HOME unless '/', and
+	 * whether to read the system crontabs rather than the user's.
+	*/
+	datadir = dir;
+	syscrontab = syscron;
+} // load_dir()
+
+void load_update(const batsample_t *bs)
+{	/* Sample the load and, on battery, learn from the power drawn. */
+	if (!loaded) load_model();
+	havefeat = !bs->acon && sample_load(feat) == 0;
+	if (!havefeat || bs->power <= 0 || bs->estimated) return;
+	learn(feat, bs->power / 1e6);
+	save_model();
+} // load_update()
+
+int load_predict(const batsample_t *bs, int batquit, loadpred_t *lp)
+{	/* Fill in lp, returns -1 and leaves it unknown if the model has not
+	 * learned enough or the battery's energy is not known.
+	*/
+	lp->watts = -1;
+	lp->mins = lp->cronmins = -1;
+	lp->cronjobs = 0;
+	if (!loaded) load_model();
+	if (!havefeat || model.n < LOAD_MIN_SAMPLES || bs->energy_now < 0
+		|| bs->energy_full <= 0) return -1;
+	lp->watts = model_watts(feat);
+	double left = bs->energy_now - (double)bs->energy_full * batquit / 100;
+	if (left <= 0) {
+		lp->mins = lp->cronmins = 0;
+		return 0;
+	}
+	lp->mins = left / 1e6 / lp->watts * 60;
+	if (lp->mins > LOAD_HORIZON) lp->mins = LOAD_HORIZON;
+	if (time(NULL) - cronread >= LOAD_CRON_SECS) read_crontabs();
+	// Each job's extra load, one more busy CPU and one more cgroup.
+	double dx[LOAD_FEATURES] = { 0 };
+	dx[1] = 1.0 / sysconf(_SC_NPROCESSORS_ONLN);
+	dx[5] = 0.1;
+	int started[LOAD_HORIZON] = { 0 };	// jobs starting each minute
+	int running = 0;
+	time_t now = time(NULL) / 60 * 60;
+	int m;
+	for (m = 0; m < LOAD_HORIZON && left > 0; m++) {
+		time_t t = now + 60 * (m + 1);
+		struct tm tm;
+		localtime_r(&t, &tm);
+		int j;
+		for (j = 0; j < njobs; j++) started[m] += job_due(&jobs[j], &tm);
+		running += started[m];
+		if (m >= LOAD_JOB_MINS) running -= started[m - LOAD_JOB_MINS];
+		lp->cronjobs += started[m];
+		double x[LOAD_FEATURES];
+		int i;
+		for (i = 0; i < LOAD_FEATURES; i++) {
+			x[i] = feat[i] + running * dx[i];
+		}
+		if (x[1] > 1) x[1] = 1;
+		// until the model has seen busier times it may say otherwise.
+		double w = model_watts(x);
+		left -= ((w > lp->watts) ? w : lp->watts) * 1e6 / 60;
+	}
+	lp->cronmins = m;
+	return 0;
+} // load_predict()
+
+static void load_model(void)
+{	/* A model that knows nothing: large P, so the first samples count
+	 * for a lot.
+	*/
+	loaded = 1;
+	FILE *fpi = fopen(datadir_path(datadir, "load.model"), "r");
+	if (fpi) {
+		int ok = (fread(&model, sizeof(model_t), 1, fpi) == 1
+					&& model.magic == MODEL_MAGIC);
+		fclose(fpi);
+		if (ok) return;
+	}
+	memset(&model, 0, sizeof(model_t));
+	model.magic = MODEL_MAGIC;
+	int i;
+	for (i = 0; i < LOAD_FEATURES; i++) model.p[i][i] = 1000;
+} // load_model()
+
+static void save_model(void)
+{
+	FILE *fpo = fopen(datadir_path(datadir, "load.model"), "w");
+	if (!fpo) return;
+	fwrite(&model, sizeof(model_t), 1, fpo);
+	fclose(fpo);
+} // save_model()
+
+static int sample_load(double *x)
+{	/* The features, scaled to about 0 to 1. */
+	double busy = cpu_busy();
+	if (busy < 0) return -1;
+	x[0] = 1;
+	x[1] = busy;
+	x[2] = readpressure("cpu");
+	x[3] = readpressure("io");
+	x[4] = readpressure("memory");
+	x[5] = count_cgroups() / 10.0;
+	return 0;
+} // sample_load()
+
+static double cpu_busy(void)
+{	/* Busy fraction of all CPUs over about the last 10 seconds, like
+	 * avg10, so that it goes with the power read now. If the last
+	 * reading is older than that, take a short one.
+	*/
+	static long long busy0, total0;
+	static time_t when0;
+	long long busy, total;
+	if (time(NULL) - when0 > 10) {
+		if (read_cpu(&busy0, &total0) == -1) return -1;
+		struct timespec ts = { 0, 250000000 };
+		nanosleep(&ts, NULL);
+	}
+	if (read_cpu(&busy, &total) == -1) return -1;
+	double frac = (total > total0) ?
+					(double)(busy - busy0) / (total - total0) : 0;
+	busy0 = busy;
+	total0 = total;
+	when0 = time(NULL);
+	return frac;
+} // cpu_busy()
+
+static int read_cpu(long long *busy, long long *total)
+{
+	long long v[8] = { 0 };
+	FILE *fpi = fopen("/proc/stat", "r");
+	if (!fpi) return -1;
+	int got = fscanf(fpi, "cpu %lld %lld %lld %lld %lld %lld %lld %lld",
+				&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+	fclose(fpi);
+	if (got < 4) return -1;
+	*total = 0;
+	int i;
+	for (i = 0; i < 8; i++) *total += v[i];
+	*busy = *total - v[3] - v[4];	// less idle and iowait
+	return 0;
+} // read_cpu()
+
+static int count_cgroups(void)
+{	/* Populated cgroups, services and sessions, in the v2 hierarchy. */
+	const char *root = "/sys/fs/cgroup";
+	if (fileexists("/sys/fs/cgroup/cgroup.controllers") == -1) {
+		root = "/sys/fs/cgroup/unified";	// hybrid v1 and v2
+	}
+	cgcount = 0;
+	nftw(root, cg_visit, 16, FTW_PHYS | FTW_ACTIONRETVAL);
+	return cgcount;
+} // count_cgroups()
+
+static int cg_visit(const char *path, const struct stat *sb, int type,
+					struct FTW *ftw)
+{
+	(void)sb;
+	if (type != FTW_D) return FTW_CONTINUE;
+	if (ftw->level > 3) return FTW_SKIP_SUBTREE;
+	if (ftw->level == 0) return FTW_CONTINUE;
+	char events[PATH_MAX];
+	snprintf(events, PATH_MAX, "%s/cgroup.events", path);
+	FILE *fpi = fopen(events, "r");
+	if (!fpi) return FTW_SKIP_SUBTREE;
+	int populated = 0;
+	if (fscanf(fpi, "populated %d", &populated) != 1) populated = 0;
+	fclose(fpi);
+	if (!populated) return FTW_SKIP_SUBTREE;
+	cgcount++;
+	return FTW_CONTINUE;
+} // cg_visit()
+
+static void learn(const double *x, double y)
+{	/* One step of recursive least squares, O(LOAD_FEATURES^2). */
+	double px[LOAD_FEATURES], k[LOAD_FEATURES];
+	double denom = LOAD_LAMBDA, err = y;
+	int i, j;
+	for (i = 0; i < LOAD_FEATURES; i++) {
+		px[i] = 0;
+		for (j = 0; j < LOAD_FEATURES; j++) px[i] += model.p[i][j] * x[j];
+		denom += x[i] * px[i];
+		err -= model.theta[i] * x[i];
+	}
+	for (i = 0; i < LOAD_FEATURES; i++) {
+		k[i] = px[i] / denom;
+		model.theta[i] += k[i] * err;
+	}
+	// A load that never changes would otherwise wind P up for ever.
+	double trace = 0;
+	for (i = 0; i < LOAD_FEATURES; i++) trace += model.p[i][i];
+	double forget = (trace < 1e4) ? LOAD_LAMBDA : 1;
+	for (i = 0; i < LOAD_FEATURES; i++) {
+		for (j = 0; j < LOAD_FEATURES; j++) {
+			model.p[i][j] = (model.p[i][j] - k[i] * px[j]) / forget;
+		}
+	}
+	model.n++;
+} // learn()
+
+static double model_watts(const double *x)
+{
+	double w = 0;
+	int i;
+	for (i = 0; i < LOAD_FEATURES; i++) w += model.theta[i] * x[i];
+	return (w < 0.1) ? 0.1 : w;
+} // model_watts()
+
+static void read_crontabs(void)
+{
+	njobs = 0;
+	cronread = time(NULL);
+	if (!syscrontab) {
+		FILE *fpi = popen("crontab -l 2>/dev/null", "r");
+		if (!fpi) return;
+		read_crontab(fpi, 0);
+		pclose(fpi);
+		return;
+	}
+	FILE *fpi = fopen("/etc/crontab", "r");
+	if (fpi) {
+		read_crontab(fpi, 1);
+		fclose(fpi);
+	}
+	DIR *dp = opendir("/etc/cron.d");
+	if (!dp) return;
+	struct dirent *de;
+	while ((de = readdir(dp))) {
+		// cron itself ignores names with dots, backups and the like.
+		if (strchr(de->d_name, '.') || strchr(de->d_name, '~')) continue;
+		char path[PATH_MAX];
+		snprintf(path, PATH_MAX, "/etc/cron.d/%s", de->d_name);
+		fpi = fopen(path, "r");
+		if (!fpi) continue;
+		read_crontab(fpi, 1);
+		fclose(fpi);
+	}
+	closedir(dp);
+} // read_crontabs()
+
+static void read_crontab(FILE *fpi, int userfield)
+{
+	char line[1024];
+	while (njobs < LOAD_MAX_JOBS && fgets(line, sizeof(line), fpi)) {
+		if (parse_job(line, userfield, &jobs[njobs]) == 0) njobs++;
+	}
+} // read_crontab()
+
+static int parse_job(char *line, int userfield, cronjob_t *job)
+{	/* 0 for a timed job, -1 for anything else: comments, variable
+	 * settings, @reboot, bad lines and autosd's own entry.
+	*/
+	static const char *const months[] = { "jan", "feb", "mar", "apr",
+		"may", "jun", "jul", "aug", "sep", "oct", "nov", "dec", NULL };
+	static const char *const days[] = { "sun", "mon", "tue", "wed",
+		"thu", "fri", "sat", NULL };
+	static const char *const special[][2] = {
+		{ "@hourly", "0 * * * *" }, { "@daily", "0 0 * * *" },
+		{ "@midnight", "0 0 * * *" }, { "@weekly", "0 0 * * 0" },
+		{ "@monthly", "0 0 1 * *" }, { "@yearly", "0 0 1 1 *" },
+		{ "@annually", "0 0 1 1 *" }, { NULL, NULL }
+	};
+	char f[5][64], first[64];
+	int used;
+	if (sscanf(line, " %63s%n", first, &used) != 1) return -1;
+	if (first[0] == '#' || strchr(first, '=')) return -1;
+	char *rest = line + used;
+	if (first[0] == '@') {
+		int i;
+		for (i = 0; special[i][0]; i++) {
+			if (strcmp(first, special[i][0]) == 0) break;
+		}
+		if (!special[i][0]) return -1;	// @reboot
+		sscanf(special[i][1], "%s %s %s %s %s", f[0], f[1], f[2], f[3],
+				f[4]);
+	} else {
+		strcpy(f[0], first);
+		if (sscanf(rest, " %63s %63s %63s %63s%n", f[1], f[2], f[3], f[4],
+					&used) != 4) return -1;
+		rest += used;
+	}
+	if (userfield) {
+		char user[64];
+		if (sscanf(rest, " %63s%n", user, &used) != 1) return -1;
+		rest += used;
+	}
+	if (strstr(rest, "autosd")) return -1;
+	uint64_t bits;
+	memset(job, 0, sizeof(cronjob_t));
+	if (parse_field(f[0], 0, 59, NULL, &job->min) == -1) return -1;
+	if (parse_field(f[1], 0, 23, NULL, &bits) == -1) return -1;
+	job->hour = bits;
+	if (parse_field(f[2], 1, 31, NULL, &bits) == -1) return -1;
+	job->dom = bits;
+	if (parse_field(f[3], 1, 12, months, &bits) == -1) return -1;
+	job->mon = bits;
+	if (parse_field(f[4], 0, 7, days, &bits) == -1) return -1;
+	job->dow = (bits | (bits >> 7)) & 0x7f;	// 7 is Sunday too
+	job->domstar = (f[2][0] == '*');
+	job->dowstar = (f[4][0] == '*');
+	return 0;
+} // parse_job()
+
+static int parse_field(const char *s, int lo, int hi,
+						const char *const *names, uint64_t *bits)
+{	/* Lists of '*', n, n-m or a name, each optionally /step. */
+	*bits = 0;
+	while (*s) {
+		int a, b, step = 1;
+		char *end;
+		if (*s == '*') {
+			a = lo;
+			b = hi;
+			s++;
+		} else {
+			int i = -1;
+			if (names) {
+				for (i = 0; names[i]; i++) {
+					if (strncasecmp(s, names[i], 3) == 0) break;
+				}
+				if (!names[i]) i = -1;
+			}
+			if (i >= 0) {
+				a = b = i + (lo == 1);	// jan is 1, sun is 0
+				s += 3;
+			} else {
+				a = b = strtol(s, &end, 10);
+				if (end == s) return -1;
+				s = end;
+			}
+			if (*s == '-') {
+				b = strtol(s + 1, &end, 10);
+				if (end == s + 1) return -1;
+				s = end;
+			}
+		}
+		if (*s == '/') {
+			step = strtol(s + 1, &end, 10);
+			if (end == s + 1 || step < 1) return -1;
+			s = end;
+			if (a == b) b = hi;		// n/step runs to the end
+		}
+		if (a < lo || b > hi || a > b) return -1;
+		int v;
+		for (v = a; v <= b; v += step) *bits |= 1ULL << v;
+		if (*s == ',') s++;
+		else if (*s) return -1;
+	}
+	return 0;
+} // parse_field()
+
+static int job_due(const cronjob_t *job, const struct tm *tm)
+{	/* As cron: if day of month and day of week are both restricted,
+	 * either may match.
+	*/
+	if (!(job->min >> tm->tm_min & 1) || !(job->hour >> tm->tm_hour & 1)
+		|| !(job->mon >> (tm->tm_mon + 1) & 1)) return 0;
+	int dom = job->dom >> tm->tm_mday & 1;
+	int dow = job->dow >> tm->tm_wday & 1;
+	if (job->domstar || job->dowstar) return dom && dow;
+	return dom || dow;
+} // job_due()
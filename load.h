@@ -0,0 +1,55 @@
+/*
+ * load.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _LOAD_H
+#define _LOAD_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <limits.h>
+#include <ftw.h>
+#include "fileops.h"
+#include "battery.h"
+
+#define LOAD_FEATURES 6		// 1, cpu, psi cpu, psi io, psi memory, cgroups
+#define LOAD_LAMBDA 0.995	// forgetting factor, about 200 samples
+#define LOAD_MIN_SAMPLES 12	// before the model is trusted
+#define LOAD_MAX_JOBS 64	// cron entries considered
+#define LOAD_JOB_MINS 10	// a cron job is assumed to run this long
+#define LOAD_CRON_SECS 600	// crontabs are re-read this often
+#define LOAD_HORIZON 1440	// minutes looked ahead
+
+typedef struct loadpred_t {
+	double watts;	// predicted draw under the current load
+	int mins;		// to quit_level at that draw
+	int cronmins;	// to quit_level with cron jobs starting as due
+	int cronjobs;	// jobs due to start within cronmins
+} loadpred_t;
+
+void load_dir(const char *dir, int syscron);
+void load_update(const batsample_t *bs);
+int load_predict(const batsample_t *bs, int batquit, loadpred_t *lp);
+
+#endif
@@ -0,0 +1,270 @@
+/* measure.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "measure.h"
+
+/* Energy used by a command. While it runs the battery's power is read
+ * MEAS_HZ times a second and integrated, and any readable RAPL package
+ * and dram counters are read as often, so that a counter wrapping past
+ * max_energy_range_uj more than once in a long run is still counted.
+ * Battery figures are only meaningful off mains, RAPL ones either way.
+ * The wait between reads ends as soon as the command exits, so that the
+ * time and energy are not padded out to the next read.
+*/
+
+typedef struct rapl_t {
+	char label[32];
+	char path[PATH_MAX];	// of energy_uj
+	long max;				// max_energy_range_uj
+	long last;
+	long total;				// uJ this run
+} rapl_t;
+
+enum { COL_SECS, COL_JOULES, COL_WATTS, COL_RAPL };
+
+static int find_rapl(rapl_t *dom);
+static void read_rapl(rapl_t *dom, int ndom);
+static int run_once(char **cmd, rapl_t *dom, int ndom, double *row);
+static int child_fd(pid_t pid);
+static int wait_tick(int pidfd, const struct timespec *next);
+static int cmp_double(const void *a, const void *b);
+static void report(const char *label, double *res, int ncol, int col,
+					int n);
+
+int measure(char **cmd, int reps)
+{	/* Run cmd reps times, report each run then the median and the 95%
+	 * confidence interval of the mean. Returns an exit status.
+	*/
+	rapl_t dom[MEAS_MAX_DOM];
+	int ndom = find_rapl(dom);
+	int ncol = COL_RAPL + ndom;
+	double *res = docalloc(reps * ncol, sizeof(double), "measure");
+	batsample_t bs;
+	if (read_battery(&bs) == 0 && bs.acon) {
+		fputs("On mains power: battery figures are not the machine's"
+				" draw and are left out.\n", stderr);
+	}
+	int n, status = EXIT_SUCCESS;
+	for (n = 0; n < reps; n++) {
+		double *row = &res[n * ncol];
+		int rc = run_once(cmd, dom, ndom, row);
+		fprintf(stdout, "run %d: %.2f s", n + 1, row[COL_SECS]);
+		if (row[COL_JOULES] >= 0) {
+			fprintf(stdout, ", battery %.1f J %.2f W", row[COL_JOULES],
+					row[COL_WATTS]);
+		}
+		int d;
+		for (d = 0; d < ndom; d++) {
+			fprintf(stdout, ", %s %.1f J", dom[d].label,
+					row[COL_RAPL + d]);
+		}
+		fputs("\n", stdout);
+		if (rc == -1) {		// killed, don't carry on
+			n++;
+			status = EXIT_FAILURE;
+			break;
+		}
+		if (rc != 0) {
+			fprintf(stderr, "%s exited with status %d\n", cmd[0], rc);
+			status = EXIT_FAILURE;
+		}
+		fflush(stdout);
+	}
+	if (n > 1) {
+		char head[16];
+		sprintf(head, "%d runs", n);
+		fprintf(stdout, "%-12s%10s%s\n", head, "median", "      mean ± 95% CI");
+		report("time s", res, ncol, COL_SECS, n);
+		report("battery J", res, ncol, COL_JOULES, n);
+		report("battery W", res, ncol, COL_WATTS, n);
+		int d;
+		for (d = 0; d < ndom; d++) {
+			char label[40];
+			snprintf(label, sizeof(label), "%.31s J", dom[d].label);
+			report(label, res, ncol, COL_RAPL + d, n);
+		}
+	}
+	free(res);
+	return status;
+} // measure()
+
+static int find_rapl(rapl_t *dom)
+{	/* Package and dram domains whose counters we may read, newer
+	 * kernels keep energy_uj to root.
+	*/
+	DIR *dp = opendir(RAPL_DIR);
+	if (!dp) return 0;
+	int ndom = 0;
+	struct dirent *de;
+	while ((de = readdir(dp)) && ndom < MEAS_MAX_DOM) {
+		if (strncmp(de->d_name, "intel-rapl:", 11) != 0) continue;
+		char path[PATH_MAX], name[32];
+		sprintf(path, "%s%s/name", RAPL_DIR, de->d_name);
+		FILE *fpi = fopen(path, "r");
+		if (!fpi) continue;
+		int got = (fscanf(fpi, "%31s", name) == 1);
+		fclose(fpi);
+		if (!got) continue;
+		rapl_t *r = &dom[ndom];
+		if (strncmp(name, "package", 7) == 0) {
+			strcpy(r->label, name);
+		} else if (strcmp(name, "dram") == 0) {
+			sprintf(r->label, "dram-%c", de->d_name[11]);	// socket
+		} else {
+			continue;
+		}
+		sprintf(path, "%s%s/max_energy_range_uj", RAPL_DIR, de->d_name);
+		r->max = readsysval(path);
+		sprintf(r->path, "%s%s/energy_uj", RAPL_DIR, de->d_name);
+		if (r->max <= 0 || readsysval(r->path) == -1) continue;
+		ndom++;
+	}
+	closedir(dp);
+	return ndom;
+} // find_rapl()
+
+static void read_rapl(rapl_t *dom, int ndom)
+{	/* Add what each counter has gained since the last read. */
+	int d;
+	for (d = 0; d < ndom; d++) {
+		long uj = readsysval(dom[d].path);
+		if (uj == -1) continue;
+		long gain = uj - dom[d].last;
+		if (gain < 0) gain += dom[d].max + 1;	// wrapped
+		dom[d].total += gain;
+		dom[d].last = uj;
+	}
+} // read_rapl()
+
+static int run_once(char **cmd, rapl_t *dom, int ndom, double *row)
+{	/* Fill in row, the battery columns -1 if not on battery. Returns the
+	 * exit status of cmd, or -1 if it was killed.
+	*/
+	int d;
+	for (d = 0; d < ndom; d++) {
+		dom[d].last = readsysval(dom[d].path);
+		dom[d].total = 0;
+	}
+	batsample_t bs;
+	int onbat = (read_battery(&bs) == 0 && !bs.acon && bs.power >= 0);
+	double joules = 0, t0 = clock_ns(CLOCK_MONOTONIC) / 1e9, tprev = t0;
+	long pprev = onbat ? bs.power : 0;
+	// Let ^C reach the command, not us.
+	void (*oldint)(int) = signal(SIGINT, SIG_IGN);
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork()");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		signal(SIGINT, oldint);
+		execvp(cmd[0], cmd);
+		perror(cmd[0]);
+		_exit(127);
+	}
+	int pidfd = child_fd(pid);
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	int wstatus;
+	while (waitpid(pid, &wstatus, WNOHANG) == 0) {
+		next.tv_nsec += 1000000000L / MEAS_HZ;
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000L;
+		}
+		if (wait_tick(pidfd, &next)) continue;	// it exited, reap it
+		read_rapl(dom, ndom);
+		if (!onbat || read_battery(&bs) == -1 || bs.power < 0) continue;
+		double t = clock_ns(CLOCK_MONOTONIC) / 1e9;
+		joules += (bs.power + pprev) / 2e6 * (t - tprev);	// trapezoid
+		tprev = t;
+		pprev = bs.power;
+		if (bs.acon) onbat = 0;
+	}
+	double t = clock_ns(CLOCK_MONOTONIC) / 1e9;
+	if (pidfd != -1) close(pidfd);
+	signal(SIGINT, oldint);
+	read_rapl(dom, ndom);
+	joules += pprev / 1e6 * (t - tprev);
+	row[COL_SECS] = t - t0;
+	row[COL_JOULES] = onbat ? joules : -1;
+	row[COL_WATTS] = onbat ? joules / (t - t0) : -1;
+	for (d = 0; d < ndom; d++) row[COL_RAPL + d] = dom[d].total / 1e6;
+	if (WIFSIGNALED(wstatus)) return -1;
+	return WEXITSTATUS(wstatus);
+} // run_once()
+
+static int child_fd(pid_t pid)
+{	/* A pidfd, readable when the child exits, or -1 on a kernel or
+	 * headers without pidfd_open(), when each wait runs its full tick.
+	*/
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	return -1;
+#endif
+} // child_fd()
+
+static int wait_tick(int pidfd, const struct timespec *next)
+{	/* Until next, or until the child exits, when it returns 1. */
+	if (pidfd == -1) {
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next,
+								NULL) == EINTR);
+		return 0;
+	}
+	double left = (next->tv_sec * 1000000000LL + next->tv_nsec
+					- clock_ns(CLOCK_MONOTONIC)) / 1e9;
+	if (left <= 0) return 0;
+	struct pollfd pfd = { pidfd, POLLIN, 0 };
+	return poll(&pfd, 1, (int)(left * 1000 + 0.999)) == 1;
+} // wait_tick()
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+} // cmp_double()
+
+static void report(const char *label, double *res, int ncol, int col,
+					int n)
+{	/* One line of the summary, skipped if any run lacks the figure. */
+	static const double t95[] = {	// Student's t, 1 to 30 df
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+		2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+		2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+		2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	double v[n], sum = 0, ss = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		v[i] = res[i * ncol + col];
+		if (v[i] < 0) return;
+		sum += v[i];
+	}
+	double mean = sum / n;
+	for (i = 0; i < n; i++) ss += (v[i] - mean) * (v[i] - mean);
+	double t = (n - 1 <= 30) ? t95[n - 2] : 1.960;
+	double ci = t * sqrt(ss / (n - 1) / n);
+	qsort(v, n, sizeof(double), cmp_double);
+	double median = (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+	fprintf(stdout, "%-12s%10.2f%14.2f ± %.2f\n", label, median, mean, ci);
+} // report()
@@ -0,0 +1,48 @@
+/*
+ * measure.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _MEASURE_H
+#define _MEASURE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include "fileops.h"
+#include "battery.h"
+
+#ifndef RAPL_DIR
+#define RAPL_DIR "/sys/class/powercap/"
+#endif
+
+#define MEAS_HZ 10			// battery and RAPL reads a second
+#define MEAS_MAX_DOM 8		// RAPL package and dram domains
+
+int measure(char **cmd, int reps);
+
+#endif
@@ -0,0 +1,238 @@
+/* profile.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "profile.h"
+
+/* High rate power profiling. A sampling thread pinned to one CPU reads
+ * power, current and voltage on an absolute clock and pushes each
+ * sample onto a lock free ring; it never touches the disk, and if the
+ * ring is full the sample is dropped and counted rather than waited
+ * for. A writer thread drains the ring in batches to the output file,
+ * which begins with the 8 byte magic "ASDPROF1" followed by profrec_t
+ * records, and keeps what the summary needs.
+*/
+
+typedef struct profile_t {
+	ring_t *ring;
+	long period;		// ns between samples
+	int fdp, fdc, fdv;	// power_now, current_now, voltage_now
+	long dropped;
+	long late;			// total ns late waking, for jitter
+	long maxlate;
+	long nsampled;
+	int writerdone;		// set once the sampler has finished
+	int ofd;
+	int64_t *power;		// every power reading, for percentiles
+	long npower;
+	double joules;
+	profrec_t last;
+} profile_t;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig);
+static void *sampler(void *arg);
+static void *writer(void *arg);
+static void pin_to_cpu(void);
+static int64_t read_fd(int fd);
+static int cmp_int64(const void *a, const void *b);
+static void summary(profile_t *pf, double secs);
+
+int profile_power(int hz, const char *output, int secs)
+{	/* Profile at hz for secs seconds, or until interrupted if secs is
+	 * 0. Returns an exit status.
+	*/
+	if (hz < 1 || hz > PROF_MAX_HZ) {
+		fprintf(stderr, "Profile rate must be 1 to %d Hz.\n", PROF_MAX_HZ);
+		return EXIT_FAILURE;
+	}
+	profile_t pf = { 0 };
+	pf.period = 1000000000L / hz;
+	pf.fdp = open(PS_BAT "power_now", O_RDONLY);
+	pf.fdc = open(PS_BAT "current_now", O_RDONLY);
+	pf.fdv = open(PS_BAT "voltage_now", O_RDONLY);
+	if (pf.fdp == -1 && (pf.fdc == -1 || pf.fdv == -1)) {
+		fputs("The battery reports neither power_now nor current_now"
+				" and voltage_now.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	pf.ofd = doopen(output, "w");
+	dowrite(pf.ofd, "ASDPROF1");
+	pf.ring = ring_new(PROF_RING, sizeof(profrec_t));
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (secs) {
+		signal(SIGALRM, on_signal);
+		alarm(secs);
+	}
+	fprintf(stdout, "Profiling at %d Hz to %s, interrupt to stop.\n", hz,
+			output);
+	fflush(stdout);
+	pthread_t stid, wtid;
+	int64_t start = clock_ns(CLOCK_MONOTONIC);
+	if (pthread_create(&wtid, NULL, writer, &pf)
+		|| pthread_create(&stid, NULL, sampler, &pf)) {
+		fputs("Unable to start the profile threads.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	pthread_join(stid, NULL);
+	double elapsed = (clock_ns(CLOCK_MONOTONIC) - start) / 1e9;
+	__atomic_store_n(&pf.writerdone, 1, __ATOMIC_RELEASE);
+	pthread_join(wtid, NULL);
+	close(pf.ofd);
+	summary(&pf, elapsed);
+	free(pf.power);
+	ring_free(pf.ring);
+	return EXIT_SUCCESS;
+} // profile_power()
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+} // on_signal()
+
+static void *sampler(void *arg)
+{	/* Wake at absolute times so that lateness does not accumulate. */
+	profile_t *pf = arg;
+	pin_to_cpu();
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	int64_t start = next.tv_sec * 1000000000LL + next.tv_nsec;
+	int64_t due = start;
+	while (!stop) {
+		int64_t now = clock_ns(CLOCK_MONOTONIC);
+		long late = now - due;
+		if (late > 0) {
+			pf->late += late;
+			if (late > pf->maxlate) pf->maxlate = late;
+		}
+		profrec_t rec;
+		rec.ns = now - start;
+		rec.current = read_fd(pf->fdc);
+		rec.voltage = read_fd(pf->fdv);
+		rec.power = read_fd(pf->fdp);
+		if (rec.power == -1 && rec.current >= 0 && rec.voltage >= 0) {
+			rec.power = rec.current * rec.voltage / 1000000;
+		}
+		pf->nsampled++;
+		if (ring_push(pf->ring, &rec) == -1) pf->dropped++;
+		due += pf->period;
+		next.tv_sec = due / 1000000000LL;
+		next.tv_nsec = due % 1000000000LL;
+		while (!stop && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+											&next, NULL) == EINTR);
+	}
+	return NULL;
+} // sampler()
+
+static void *writer(void *arg)
+{	/* Batch the ring out to disk, sleeping briefly when it is empty. */
+	profile_t *pf = arg;
+	profrec_t batch[PROF_BATCH];
+	long cap = 0;
+	while (1) {
+		int done = __atomic_load_n(&pf->writerdone, __ATOMIC_ACQUIRE);
+		int n = 0;
+		while (n < PROF_BATCH && ring_pop(pf->ring, &batch[n]) == 0) n++;
+		if (n == 0) {
+			if (done) break;
+			struct timespec ts = { 0, 100000000 };
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		ssize_t want = n * sizeof(profrec_t);
+		if (write(pf->ofd, batch, want) != want) {
+			perror("write()");
+			exit(EXIT_FAILURE);
+		}
+		int i;
+		for (i = 0; i < n; i++) {
+			if (batch[i].power < 0) continue;
+			if (pf->npower == cap) {
+				cap = cap ? 2 * cap : 4096;
+				pf->power = realloc(pf->power, cap * sizeof(int64_t));
+				if (!pf->power) {
+					fputs("Failed to get memory in writer\n", stderr);
+					exit(EXIT_FAILURE);
+				}
+			}
+			pf->power[pf->npower++] = batch[i].power;
+			if (pf->npower > 1) {	// trapezoid rule
+				double dt = (batch[i].ns - pf->last.ns) / 1e9;
+				pf->joules += (batch[i].power + pf->last.power) / 2e6 * dt;
+			}
+			pf->last = batch[i];
+		}
+	}
+	return NULL;
+} // writer()
+
+static void pin_to_cpu(void)
+{	/* The last CPU we may run on, away from CPU 0's interrupts. */
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == -1) return;
+	int cpu, last = -1;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &set)) last = cpu;
+	}
+	if (last == -1) return;
+	CPU_ZERO(&set);
+	CPU_SET(last, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+} // pin_to_cpu()
+
+static int64_t read_fd(int fd)
+{	// sysfs attributes can be re-read from offset 0 of an open fd.
+	char buf[32];
+	if (fd == -1) return -1;
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0) return -1;
+	buf[len] = '\0';
+	int64_t val = strtoll(buf, NULL, 10);
+	return (val < 0) ? -val : val;	// some drivers sign discharge
+} // read_fd()
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+} // cmp_int64()
+
+static void summary(profile_t *pf, double secs)
+{
+	fprintf(stdout, "Samples: %ld in %.1f s, %ld dropped\n", pf->nsampled,
+			secs, pf->dropped);
+	if (pf->nsampled) {
+		fprintf(stdout, "Wake up lateness: mean %.1f us, max %.1f us\n",
+				pf->late / 1e3 / pf->nsampled, pf->maxlate / 1e3);
+	}
+	if (!pf->npower) return;
+	double sum = 0;
+	long i;
+	for (i = 0; i < pf->npower; i++) sum += pf->power[i];
+	qsort(pf->power, pf->npower, sizeof(int64_t), cmp_int64);
+	fprintf(stdout, "Power: mean %.3f W, p50 %.3f W, p99 %.3f W\n",
+			sum / pf->npower / 1e6, pf->power[pf->npower / 2] / 1e6,
+			pf->power[(pf->npower - 1) * 99 / 100] / 1e6);
+	fprintf(stdout, "Energy: %.1f J (%.4f Wh)\n", pf->joules,
+			pf->joules / 3600);
+} // summary()
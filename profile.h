@@ -0,0 +1,51 @@
+/*
+ * profile.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include "fileops.h"
+#include "battery.h"
+#include "ring.h"
+
+#define PROF_MAX_HZ 100
+#define PROF_RING 4096		// samples, 40 s at the highest rate
+#define PROF_BATCH 256		// samples per write()
+#define PROF_OUTPUT "autosd-power.bin"
+
+typedef struct profrec_t {	// as written to the output file
+	int64_t ns;			// since the profile began
+	int64_t power;		// uW
+	int64_t current;	// uA, -1 unknown
+	int64_t voltage;	// uV, -1 unknown
+} profrec_t;
+
+int profile_power(int hz, const char *output, int secs);
+
+#endif
@@ -0,0 +1,136 @@
+/* reload.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "reload.h"
+
+/* Config edits take effect in a running instance. A thread waits on
+ * inotify for a watched file to be written or renamed into place, as
+ * editors do, and parses it with the caller's function into a fresh
+ * block. If that accepts it the block is published by swapping one
+ * pointer, so the sampling loop reads the settings with a single load
+ * and never waits on, or repeats, the parsing. If it is rejected the
+ * settings in force stay. A replaced block is not freed, the loop may
+ * still be copying it; that is a few bytes for each edit.
+*/
+
+typedef struct watch_t {
+	int wd;
+	char name[NAME_MAX];	// file of interest in the directory
+	char dir[PATH_MAX];
+} watch_t;
+
+static watch_t watches[RELOAD_MAX_WATCH];
+static int nwatch;
+static void *current;
+static size_t blksize;
+static int (*parser)(void *);
+static void (*notify)(void);
+static int ifd = -1;
+
+static void *watcher(void *arg);
+static int wanted(const struct inotify_event *ev);
+
+void reload_watch(const char *dir, const char *name)
+{	/* Watch dir for changes to name, before reload_start(). */
+	if (nwatch == RELOAD_MAX_WATCH) return;
+	strncpy(watches[nwatch].dir, dir, PATH_MAX - 1);
+	strncpy(watches[nwatch].name, name, NAME_MAX - 1);
+	nwatch++;
+} // reload_watch()
+
+void reload_start(const void *initial, size_t size, int (*parse)(void *),
+					void (*changed)(void))
+{	/* Publish initial, then reparse on edits. parse() fills in a block
+	 * that starts as a copy of the settings in force and returns 0 to
+	 * accept it, or -1 to reject it having said why. changed() is
+	 * called after each swap. Without inotify the initial settings
+	 * simply stay.
+	*/
+	blksize = size;
+	parser = parse;
+	notify = changed;
+	void *blk = docalloc(1, size, "reload_start");
+	memcpy(blk, initial, size);
+	__atomic_store_n(&current, blk, __ATOMIC_RELEASE);
+	ifd = inotify_init1(IN_CLOEXEC);
+	if (ifd == -1) return;
+	int i, any = 0;
+	for (i = 0; i < nwatch; i++) {
+		watches[i].wd = inotify_add_watch(ifd, watches[i].dir,
+									IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (watches[i].wd != -1) any = 1;
+	}
+	pthread_t tid;
+	if (!any || pthread_create(&tid, NULL, watcher, NULL)) {
+		close(ifd);
+		ifd = -1;
+		return;
+	}
+	pthread_detach(tid);
+} // reload_start()
+
+const void *reload_current(void)
+{	/* The settings in force, NULL before reload_start(). */
+	return __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+} // reload_current()
+
+static void *watcher(void *arg)
+{
+	(void)arg;
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	while (1) {
+		ssize_t len = read(ifd, buf, sizeof(buf));
+		if (len <= 0) continue;
+		int hit = 0;
+		char *cp;
+		for (cp = buf; cp < buf + len; ) {
+			const struct inotify_event *ev = (void *)cp;
+			if (wanted(ev)) hit = 1;
+			cp += sizeof(struct inotify_event) + ev->len;
+		}
+		if (!hit) continue;
+		// Editors may write more than once; take the last.
+		struct timespec ts = { 0, RELOAD_SETTLE_MS * 1000000L };
+		nanosleep(&ts, NULL);
+		void *blk = docalloc(1, blksize, "watcher");
+		memcpy(blk, reload_current(), blksize);
+		if (parser(blk) == -1) {
+			fputs("Config edit rejected, keeping the settings in force."
+					"\n", stderr);
+			free(blk);
+			continue;
+		}
+		__atomic_store_n(&current, blk, __ATOMIC_RELEASE);
+		if (notify) notify();
+	}
+	return NULL;
+} // watcher()
+
+static int wanted(const struct inotify_event *ev)
+{
+	int i;
+	if (!ev->len) return 0;
+	for (i = 0; i < nwatch; i++) {
+		if (ev->wd == watches[i].wd
+			&& strcmp(ev->name, watches[i].name) == 0) return 1;
+	}
+	return 0;
+} // wanted()
@@ -0,0 +1,40 @@
+/*
+ * reload.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _RELOAD_H
+#define _RELOAD_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include "fileops.h"
+
+#define RELOAD_MAX_WATCH 64	// directories watched
+#define RELOAD_SETTLE_MS 200	// let an editor finish saving
+
+void reload_watch(const char *dir, const char *name);
+void reload_start(const void *initial, size_t size, int (*parse)(void *),
+					void (*changed)(void));
+const void *reload_current(void);
+
+#endif
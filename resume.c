@@ -0,0 +1,308 @@
+/* resume.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "resume.h"
+
+/* When mains returns after an outage every host would otherwise start
+ * its deferred jobs and services at once, all on the same file and
+ * database servers. Jobs that run 'autosd --wait-resume' first wait at
+ * a gate kept in a shared memory segment only root writes. The waiters'
+ * ticket counter is in a second one any local user may write. Only an
+ * instance running as root, the daemon or root's cron job, looks after
+ * the gate, and it makes afresh a segment some other user made first.
+ *
+ * Any sample on battery closes the gate and marks the outage on disk,
+ * so that if the outage shut the host down the gate is closed again at
+ * boot. Once mains is back the gate stays closed for a delay particular
+ * to this host, so that a fleet comes back spread out, and until the
+ * battery has recharged to resume_level, or for RESUME_RECHARGE_MAX
+ * more if it is slow to, as a worn one may never. It then opens in
+ * batches: each waiter takes a ticket and goes once the released count
+ * passes it. The first batch is one, and each step doubles it while
+ * this host's cpu and io pressure stay low, or halves it if not. When
+ * nobody has waited for a few steps, or after RESUME_MAX_STEPS whatever
+ * tickets were taken, the gate is left open.
+*/
+
+typedef struct gate_t {
+	int state;			// GATE_OPEN, GATE_CLOSED or GATE_OPENING
+	pid_t pid;			// instance opening the gate
+	time_t updated;		// last touched by an instance
+	unsigned released;	// tickets below this may go
+	int batch;			// released at the last step
+} gate_t;
+
+static gate_t *gate;		// mapping, NULL until needed
+static unsigned *ticket;	// next ticket for a waiter
+static int gfd = -1;		// kept open, flocked while opening the gate
+
+static int map_gate(int create);
+static void *map_segment(const char *name, size_t size, mode_t mode,
+							int create, int *fdp);
+static int hold_closed(int delay, int level);
+static int host_jitter(int delay);
+static double pressure_now(void);
+static int step_wait(void);
+
+void resume_outage(void)
+{	/* On battery: close the gate, starting a new round of tickets, and
+	 * note the outage for after a shutdown. Root only.
+	*/
+	if (map_gate(1) == -1) return;
+	if (__atomic_load_n(&gate->state, __ATOMIC_ACQUIRE) != GATE_CLOSED) {
+		__atomic_store_n(&gate->state, GATE_CLOSED, __ATOMIC_RELEASE);
+		__atomic_store_n(&gate->released, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(ticket, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&gate->batch, 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&gate->updated, time(NULL), __ATOMIC_RELAXED);
+	if (fileexists(RESUME_MARK) == -1) {
+		mkdir(RESUME_DIR, 0755);
+		int fd = open(RESUME_MARK, O_WRONLY | O_CREAT, 0644);
+		if (fd != -1) close(fd);
+	}
+} // resume_outage()
+
+int resume_pending(void)
+{	/* Is there an outage the gate has not yet been opened after? One
+	 * from before this boot is only on disk; root closes the gate again
+	 * for it.
+	*/
+	if (map_gate(0) == -1) {
+		if (geteuid() != 0 || fileexists(RESUME_MARK) == -1) return 0;
+		resume_outage();
+		if (!gate) return 0;
+	}
+	return __atomic_load_n(&gate->state, __ATOMIC_ACQUIRE) != GATE_OPEN;
+} // resume_pending()
+
+int resume_gate(int delay, int level)
+{	/* On mains after an outage. Returns 0 once the gate is open, or if
+	 * another instance is opening it, -1 if mains failed again.
+	*/
+	if (geteuid() != 0 || !resume_pending()) return 0;
+	if (flock(gfd, LOCK_EX | LOCK_NB) == -1) return 0;
+	__atomic_store_n(&gate->pid, getpid(), __ATOMIC_RELAXED);
+	if (hold_closed(delay, level) == -1) {
+		flock(gfd, LOCK_UN);
+		return -1;
+	}
+	int batch = 1, quiet = 0, steps = 0;
+	__atomic_store_n(&gate->batch, batch, __ATOMIC_RELAXED);
+	__atomic_store_n(&gate->state, GATE_OPENING, __ATOMIC_RELEASE);
+	// Let those already waiting see that and take their tickets.
+	struct timespec ts = { 0, 2 * RESUME_POLL_MS * 1000000L };
+	nanosleep(&ts, NULL);
+	while (quiet < RESUME_SETTLE_STEPS && steps++ < RESUME_MAX_STEPS) {
+		unsigned want = __atomic_load_n(ticket, __ATOMIC_ACQUIRE);
+		unsigned rel = __atomic_load_n(&gate->released, __ATOMIC_ACQUIRE);
+		int sent = (rel < want);
+		if (sent) {
+			rel = (want - rel > (unsigned)batch) ? rel + batch : want;
+			__atomic_store_n(&gate->released, rel, __ATOMIC_RELEASE);
+			quiet = 0;
+		} else {
+			quiet++;
+		}
+		if (step_wait() == -1) {
+			flock(gfd, LOCK_UN);
+			return -1;
+		}
+		if (!sent) continue;
+		// Did this host cope with the batch just let go?
+		if (pressure_now() < RESUME_PSI_BUSY) {
+			if (batch < 1 << 20) batch *= 2;
+		} else if (batch > 1) {
+			batch /= 2;
+		}
+		__atomic_store_n(&gate->batch, batch, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&gate->state, GATE_OPEN, __ATOMIC_RELEASE);
+	unlink(RESUME_MARK);
+	flock(gfd, LOCK_UN);
+	return 0;
+} // resume_gate()
+
+int resume_wait(void)
+{	/* For --wait-resume: return once this caller may go. A gate that
+	 * nobody is looking after does not hold anyone.
+	*/
+	time_t start = time(NULL);
+	while (map_gate(0) == -1) {
+		// After an outage that shut the host down, root has yet to
+		// close the gate again.
+		if (fileexists(RESUME_MARK) == -1
+			|| time(NULL) - start > RESUME_STALE) return EXIT_SUCCESS;
+		struct timespec ts = { 0, RESUME_POLL_MS * 1000000L };
+		nanosleep(&ts, NULL);
+	}
+	int have = 0;
+	unsigned mine = 0;
+	while (1) {
+		int state = __atomic_load_n(&gate->state, __ATOMIC_ACQUIRE);
+		if (state == GATE_OPEN) break;
+		if (state == GATE_CLOSED) {
+			have = 0;	// a new outage, tickets start again
+			time_t upd = __atomic_load_n(&gate->updated,
+											__ATOMIC_RELAXED);
+			if (time(NULL) - upd > RESUME_STALE) break;
+		} else {
+			pid_t pid = __atomic_load_n(&gate->pid, __ATOMIC_RELAXED);
+			if (kill(pid, 0) == -1 && errno == ESRCH) break;
+			if (!have) {
+				mine = __atomic_fetch_add(ticket, 1, __ATOMIC_ACQ_REL);
+				have = 1;
+			}
+			unsigned rel = __atomic_load_n(&gate->released,
+											__ATOMIC_ACQUIRE);
+			if (rel > mine) break;
+		}
+		struct timespec ts = { 0, RESUME_POLL_MS * 1000000L };
+		nanosleep(&ts, NULL);
+	}
+	return EXIT_SUCCESS;
+} // resume_wait()
+
+void resume_show(void)
+{	/* A line for --status, while the gate is not open. */
+	if (!resume_pending()) return;
+	if (__atomic_load_n(&gate->state, __ATOMIC_ACQUIRE) == GATE_CLOSED) {
+		fputs("Resume gate: closed\n", stdout);
+		return;
+	}
+	fprintf(stdout, "Resume gate: opening, %u of %u waiters released,"
+			" batch %d\n", gate->released, *ticket, gate->batch);
+} // resume_show()
+
+static int map_gate(int create)
+{	/* Map the gate and the tickets, which only root may create. -1 if
+	 * they are not there.
+	*/
+	if (gate) return 0;
+	if (create && geteuid() != 0) return -1;
+	int tfd = -1;
+	ticket = map_segment(TICKET_SHM, sizeof(unsigned), 0666, create, &tfd);
+	if (!ticket) return -1;
+	close(tfd);
+	gate = map_segment(GATE_SHM, sizeof(gate_t), 0644, create, &gfd);
+	if (!gate) {
+		munmap(ticket, sizeof(unsigned));
+		ticket = NULL;
+		return -1;
+	}
+	return 0;
+} // map_gate()
+
+static void *map_segment(const char *name, size_t size, mode_t mode,
+							int create, int *fdp)
+{	/* Map root's segment name, for writing if we are root or it is
+	 * world writable. With create, a segment that is missing or that
+	 * some other user made first is made afresh. NULL if it can't be.
+	*/
+	int rw = (geteuid() == 0 || (mode & S_IWOTH));
+	int prot = rw ? PROT_READ | PROT_WRITE : PROT_READ;
+	struct stat sb;
+	int fd = shm_open(name, rw ? O_RDWR : O_RDONLY, 0);
+	if (fd != -1 && (fstat(fd, &sb) == -1 || sb.st_uid != 0)) {
+		close(fd);	// not root's, don't trust it
+		fd = -1;
+		if (create) shm_unlink(name);
+	}
+	if (fd == -1 && create) {
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+		if (fd != -1) fchmod(fd, mode);	// past the umask
+	}
+	if (fd == -1) return NULL;
+	if (fstat(fd, &sb) == -1 || ((size_t)sb.st_size < size
+		&& (!create || ftruncate(fd, size) == -1))) {
+		close(fd);
+		return NULL;
+	}
+	void *m = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (m == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	*fdp = fd;
+	return m;
+} // map_segment()
+
+static int hold_closed(int delay, int level)
+{	/* Keep the gate closed for this host's share of delay and until
+	 * the battery is back to level, but no more than RESUME_RECHARGE_MAX
+	 * past the delay. -1 if mains fails meanwhile.
+	*/
+	time_t until = time(NULL) + host_jitter(delay);
+	time_t giveup = until + RESUME_RECHARGE_MAX;
+	batsample_t bs;
+	take_sample(&bs);
+	while (1) {
+		if (!bs.acon) {
+			resume_outage();
+			return -1;
+		}
+		time_t now = time(NULL);
+		if (now >= until && (bs.percent >= level || now >= giveup)) {
+			return 0;
+		}
+		__atomic_store_n(&gate->updated, time(NULL), __ATOMIC_RELAXED);
+		int secs = until - time(NULL);
+		if (secs <= 0 || secs > RESUME_STEP_SECS) secs = RESUME_STEP_SECS;
+		sleep(secs);
+		take_sample(&bs);
+	}
+} // hold_closed()
+
+static int host_jitter(int delay)
+{	/* 0 to delay seconds, the same for this host every time and spread
+	 * across a fleet: FNV-1a of the host name.
+	*/
+	char host[HOST_NAME_MAX + 1] = "";
+	gethostname(host, HOST_NAME_MAX);
+	unsigned hash = 2166136261u;
+	char *cp;
+	for (cp = host; *cp; cp++) {
+		hash ^= (unsigned char)*cp;
+		hash *= 16777619u;
+	}
+	return hash % (delay + 1);
+} // host_jitter()
+
+static double pressure_now(void)
+{	/* The greater of cpu and io some avg10, as a fraction. 0 without
+	 * PSI, when batches simply double.
+	*/
+	double cpu = readpressure("cpu");
+	double io = readpressure("io");
+	return (cpu > io) ? cpu : io;
+} // pressure_now()
+
+static int step_wait(void)
+{	/* Wait a step while opening, -1 if mains fails. */
+	sleep(RESUME_STEP_SECS);
+	batsample_t bs;
+	take_sample(&bs);
+	if (!bs.acon) {
+		resume_outage();
+		return -1;
+	}
+	__atomic_store_n(&gate->updated, time(NULL), __ATOMIC_RELAXED);
+	return 0;
+} // step_wait()
@@ -0,0 +1,60 @@
+/*
+ * resume.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _RESUME_H
+#define _RESUME_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include "battery.h"
+#include "sampler.h"
+
+#define GATE_SHM "/autosd.gate"		// written by root only
+#define TICKET_SHM "/autosd.tickets"	// by any waiter
+#define RESUME_DIR "/var/lib/autosd"
+#define RESUME_MARK RESUME_DIR "/outage"	// the gate must open after boot
+#define RESUME_STEP_SECS 10		// between batches
+#define RESUME_SETTLE_STEPS 3	// steps with nobody waiting before open
+#define RESUME_MAX_STEPS 90		// open after these whatever the tickets
+#define RESUME_RECHARGE_MAX 1800	// seconds after the delay to reach the level
+#define RESUME_PSI_BUSY 0.2		// pressure at which batches stop growing
+#define RESUME_POLL_MS 250		// waiters look this often
+#define RESUME_STALE 3600		// seconds before nobody updating a closed
+								// gate lets waiters go
+
+enum { GATE_OPEN, GATE_CLOSED, GATE_OPENING };
+
+void resume_outage(void);
+int resume_pending(void);
+int resume_gate(int delay, int level);
+int resume_wait(void);
+void resume_show(void);
+
+#endif
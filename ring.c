@@ -0,0 +1,68 @@
+/* ring.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "ring.h"
+
+/* Lock free ring for exactly one producer thread and one consumer
+ * thread. Each side only ever writes its own index; the release store
+ * of an index publishes the slot contents behind it.
+*/
+
+ring_t *ring_new(size_t count, size_t elsize)
+{	// count is rounded up to a power of 2.
+	size_t slots = 1;
+	while (slots < count) slots <<= 1;
+	ring_t *r = aligned_alloc(64, sizeof(ring_t));
+	if (!r) {
+		fputs("Failed to get memory in ring_new\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	memset(r, 0, sizeof(ring_t));
+	r->mask = slots - 1;
+	r->elsize = elsize;
+	r->slots = docalloc(slots, elsize, "ring_new");
+	return r;
+} // ring_new()
+
+int ring_push(ring_t *r, const void *el)
+{	/* Producer only. Returns -1 if the ring is full. */
+	unsigned long head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	unsigned long tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	if (head - tail > r->mask) return -1;
+	memcpy(r->slots + (head & r->mask) * r->elsize, el, r->elsize);
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+} // ring_push()
+
+int ring_pop(ring_t *r, void *el)
+{	/* Consumer only. Returns -1 if the ring is empty. */
+	unsigned long tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	unsigned long head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	if (tail == head) return -1;
+	memcpy(el, r->slots + (tail & r->mask) * r->elsize, r->elsize);
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+} // ring_pop()
+
+void ring_free(ring_t *r)
+{
+	free(r->slots);
+	free(r);
+} // ring_free()
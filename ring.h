@@ -0,0 +1,42 @@
+/*
+ * ring.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _RING_H
+#define _RING_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fileops.h"
+
+typedef struct ring_t {
+	// producer and consumer indices on their own cache lines.
+	unsigned long head __attribute__((aligned(64)));	// next to push
+	unsigned long tail __attribute__((aligned(64)));	// next to pop
+	size_t mask __attribute__((aligned(64)));	// slots - 1
+	size_t elsize;
+	char *slots;
+} ring_t;
+
+ring_t *ring_new(size_t count, size_t elsize);
+int ring_push(ring_t *r, const void *el);
+int ring_pop(ring_t *r, void *el);
+void ring_free(ring_t *r);
+
+#endif
@@ -0,0 +1,236 @@
+/* sampler.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "sampler.h"
+
+/* ACPI embedded controller reads of the battery have been seen to hang
+ * for seconds. The reads are done on a thread of their own, which hands
+ * each sample back over a single producer, single consumer ring. The
+ * decision loop waits at most SAMPLE_DEADLINE_MS; if the read is late it
+ * carries on with the last good sample run forward at the drain rate
+ * seen so far, and counts a stall. Requests made while the thread is
+ * still stuck are merged by the eventfd counter into one read. Each
+ * request is numbered and a sample carries the number of the latest
+ * request when its read began, so that a late answer to an earlier
+ * request is never taken for the answer to this one. The shutdown
+ * countdown asks for AC0 alone the same way: on ACPI that is the _PSR
+ * method, which may go through the embedded controller as well.
+*/
+
+typedef struct tagged_t {
+	uint64_t seq;		// latest request when the read began
+	int ac;				// answers an AC request, only bs.acon is set
+	int err;			// errno if the read failed, else 0
+	batsample_t bs;
+} tagged_t;
+
+static int reqfd = -1;	// decision loop -> sampler: read please
+static int acreqfd;		// decision loop -> sampler: read AC0 please
+static int donefd;		// sampler -> decision loop: sample in ring
+static ring_t *ring;
+static uint64_t reqseq;	// number of the latest request
+static uint64_t acseq;	// number of the latest AC request
+static int stalls;
+static batsample_t good;	// last good sample, good.when 0 if none
+static batsample_t disc0;	// first good sample of this discharge
+static double pctrate;		// percent per second on battery
+static double uwhrate;		// uWh per second on battery
+
+static void start_sampler(void);
+static void *sampler(void *arg);
+static void hand_back(tagged_t *ts);
+static int await(int ac, uint64_t want, long ms, tagged_t *out);
+static void new_good(const batsample_t *bs);
+static void estimate(batsample_t *bs);
+
+void take_sample(batsample_t *bs)
+{	/* The latest sample, fresh or, if late, estimated. Until there has
+	 * been one good sample there is nothing to estimate from, so the
+	 * first read is given SAMPLE_FIRST_MS and quits if it takes longer:
+	 * a cron run tries again at the next, rather than act on no read.
+	*/
+	if (reqfd == -1) start_sampler();
+	uint64_t want = __atomic_add_fetch(&reqseq, 1, __ATOMIC_RELEASE);
+	uint64_t one = 1;
+	if (write(reqfd, &one, sizeof(one)) == -1) {
+		perror("write()");
+		exit(EXIT_FAILURE);
+	}
+	tagged_t in;
+	int got = await(0, want, good.when ? SAMPLE_DEADLINE_MS
+										: SAMPLE_FIRST_MS, &in);
+	if (got && !in.err) {
+		*bs = good;
+		return;
+	}
+	if (got && !good.when) {	// not there at all, as opposed to slow
+		errno = in.err;
+		perror(PS_AC "online or " PS_BAT "capacity");
+		exit(EXIT_FAILURE);
+	}
+	if (!good.when) {
+		fprintf(stderr, "The battery was not read within %d seconds.\n",
+				SAMPLE_FIRST_MS / 1000);
+		exit(EXIT_FAILURE);
+	}
+	stalls++;
+	estimate(bs);
+} // take_sample()
+
+int sampler_acon(long ms)
+{	/* Is mains on? 1 or 0, or -1 if AC0 was not read within ms. */
+	if (reqfd == -1) start_sampler();
+	uint64_t want = __atomic_add_fetch(&acseq, 1, __ATOMIC_RELEASE);
+	uint64_t one = 1;
+	if (write(acreqfd, &one, sizeof(one)) == -1) {
+		perror("write()");
+		exit(EXIT_FAILURE);
+	}
+	tagged_t in;
+	if (!await(1, want, ms, &in) || in.err) return -1;
+	return in.bs.acon;
+} // sampler_acon()
+
+int sampler_stalls(void)
+{
+	return stalls;
+} // sampler_stalls()
+
+static void start_sampler(void)
+{
+	reqfd = eventfd(0, EFD_CLOEXEC);
+	acreqfd = eventfd(0, EFD_CLOEXEC);
+	donefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (reqfd == -1 || acreqfd == -1 || donefd == -1) {
+		perror("eventfd()");
+		exit(EXIT_FAILURE);
+	}
+	ring = ring_new(16, sizeof(tagged_t));
+	pthread_t tid;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&tid, &attr, sampler, NULL)) {
+		fputs("Unable to start the sampler thread.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	pthread_attr_destroy(&attr);
+} // start_sampler()
+
+static void *sampler(void *arg)
+{	/* Nothing here may exit(), a failed read is handed on as such. */
+	(void)arg;
+	struct pollfd pfd[2] = { { acreqfd, POLLIN, 0 }, { reqfd, POLLIN, 0 } };
+	while (1) {
+		if (poll(pfd, 2, -1) <= 0) continue;
+		uint64_t count;
+		tagged_t ts;
+		memset(&ts, 0, sizeof(tagged_t));
+		// AC0 first, it is the quicker read and the countdown is waiting.
+		if ((pfd[0].revents & POLLIN)
+			&& read(acreqfd, &count, sizeof(count)) != -1) {
+			ts.seq = __atomic_load_n(&acseq, __ATOMIC_ACQUIRE);
+			ts.ac = 1;
+			long val = readsysval(PS_AC "online");
+			if (val == -1) ts.err = errno ? errno : EIO;
+			ts.bs.acon = (val == 1);
+			hand_back(&ts);
+		}
+		if ((pfd[1].revents & POLLIN)
+			&& read(reqfd, &count, sizeof(count)) != -1) {
+			ts.seq = __atomic_load_n(&reqseq, __ATOMIC_ACQUIRE);
+			ts.ac = 0;
+			ts.err = 0;
+			if (read_battery(&ts.bs) == -1) ts.err = errno ? errno : EIO;
+			hand_back(&ts);
+		}
+	}
+	return NULL;
+} // sampler()
+
+static void hand_back(tagged_t *ts)
+{
+	if (ring_push(ring, ts) == -1) return;	// reader is behind
+	uint64_t one = 1;
+	if (write(donefd, &one, sizeof(one)) == -1) return;
+} // hand_back()
+
+static int await(int ac, uint64_t want, long ms, tagged_t *out)
+{	/* Wait up to ms for the answer to request want of that kind, into
+	 * out. Good samples that come meanwhile are kept, the newest as
+	 * good. Returns 1 if it came, 0 if it is late.
+	*/
+	struct pollfd pfd = { donefd, POLLIN, 0 };
+	long end = clock_ms(CLOCK_MONOTONIC) + ms;
+	int got = 0;
+	while (!got) {
+		long left = end - clock_ms(CLOCK_MONOTONIC);
+		if (left <= 0) break;
+		int res = poll(&pfd, 1, left);
+		if (res == -1 && errno == EINTR) continue;
+		if (res <= 0) break;
+		uint64_t count;
+		if (read(donefd, &count, sizeof(count)) == -1) break;
+		tagged_t in;
+		while (ring_pop(ring, &in) == 0) {
+			if (!in.ac && !in.err && in.bs.when >= good.when) {
+				new_good(&in.bs);
+			}
+			if (in.ac == ac && in.seq >= want) {
+				*out = in;
+				got = 1;
+			}
+		}
+	}
+	return got;
+} // await()
+
+static void new_good(const batsample_t *bs)
+{	/* Drain rates are taken over the whole discharge so far. */
+	if (bs->acon) {
+		disc0.when = 0;
+	} else if (!disc0.when) {
+		disc0 = *bs;
+	} else if (bs->when > disc0.when) {
+		double dt = bs->when - disc0.when;
+		double p = (disc0.percent - bs->percent) / dt;
+		pctrate = (p > 0) ? p : 0;
+		if (disc0.energy_now >= 0 && bs->energy_now >= 0) {
+			double e = (disc0.energy_now - bs->energy_now) / dt;
+			uwhrate = (e > 0) ? e : 0;
+		}
+	}
+	good = *bs;
+} // new_good()
+
+static void estimate(batsample_t *bs)
+{
+	*bs = good;
+	bs->when = time(NULL);
+	bs->estimated = 1;
+	if (good.acon) return;
+	time_t dt = bs->when - good.when;
+	bs->percent = good.percent - (int)(pctrate * dt + 0.999);
+	if (bs->percent < 0) bs->percent = 0;
+	if (good.energy_now >= 0) {
+		bs->energy_now = good.energy_now - (long)(uwhrate * dt);
+		if (bs->energy_now < 0) bs->energy_now = 0;
+	}
+} // estimate()
@@ -0,0 +1,42 @@
+/*
+ * sampler.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "battery.h"
+#include "ring.h"
+
+#define SAMPLE_DEADLINE_MS 2000	// longest wait on a sysfs read
+#define SAMPLE_FIRST_MS 60000	// on the first, with nothing to estimate from
+
+void take_sample(batsample_t *bs);
+int sampler_acon(long ms);
+int sampler_stalls(void);
+
+#endif
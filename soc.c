@@ -0,0 +1,263 @@
+/* soc.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "soc.h"
+
+/* A second opinion on charge left, from the battery's voltage, for aged
+ * batteries whose gauge says 12% and then die within a minute.
+ *
+ * Voltage sags under load, so it is corrected by the current times the
+ * battery's internal resistance, which is learned from changes in load.
+ * Every sample of a discharge is logged. If the machine then went down
+ * without autosd shutting it down or mains returning, and the last
+ * sample logged was at the design minimum or falling away, that
+ * discharge ran the battery flat, so working back from its end gives the
+ * energy that was really left at each voltage. A log that ends higher
+ * was a poweroff, reboot or crash on battery and is dropped. What is
+ * learned is averaged into a per battery table, the discharge curve,
+ * which is looked up to give charge left. A voltage that falls away
+ * fast is a cliff: the battery is about to quit. So is one below the
+ * design minimum, but only once the gauge or the curve puts the charge
+ * at SOC_LOW_PCT or less: many drivers give the nominal voltage as the
+ * design minimum, which a loaded pack sits under for much of its charge.
+*/
+
+#define CURVE_MAGIC 0x56525543	// "CURV"
+
+typedef struct curve_t {
+	unsigned magic;
+	long vlow;			// uV at the bottom of bin 0
+	long vstep;			// uV per bin
+	double rint;		// internal resistance, ohm, 0 unknown
+	double remain[SOC_BINS];	// uWh left to flat
+	int count[SOC_BINS];		// discharges averaged into each bin
+} curve_t;
+
+typedef struct dlrec_t {	// one sample of the discharge log
+	time_t when;
+	long voltage;		// uV, corrected for load
+	long power;			// uW
+} dlrec_t;
+
+static const char *datadir = ".config/autosd";
+static curve_t curve;
+static char curvefn[PATH_MAX];	// empty until the curve is loaded
+static batsample_t prev;		// last sample seen, prev.when 0 if none
+static long prevvc;				// its corrected voltage
+
+static void load_curve(void);
+static void save_curve(void);
+static void log_sample(const batsample_t *bs, long vc);
+static void learn_flat_discharge(void);
+static int vbin(long vc);
+static double lookup(long vc);
+static time_t boot_time(void);
+
+void soc_dir(const char *dir)
+{	// where the curve and log are kept, relative to $HOME unless '/'.
+	datadir = dir;
+} // soc_dir()
+
+void soc_update(const batsample_t *bs, soc_t *sc)
+{
+	sc->percent = -1;
+	sc->cliff = 0;
+	if (!curvefn[0]) load_curve();
+	if (bs->acon) {	// discharge over, not run flat
+		soc_end_discharge(0);
+		prev.when = 0;
+		return;
+	}
+	if (bs->voltage <= 0 || !curve.vstep) return;
+	long ua = (bs->current > 0) ? bs->current : 0;
+	if (prev.when && bs->when - prev.when <= 300 && prev.current > 0) {
+		double di = (double)ua - prev.current;
+		if (di > 200000 || di < -200000) {	// at least 0.2 A change
+			double r = -(bs->voltage - prev.voltage) / di;
+			if (r > 0 && r < 1) {
+				curve.rint = curve.rint ? 0.8 * curve.rint + 0.2 * r : r;
+				save_curve();
+			}
+		}
+	}
+	long vc = bs->voltage + (long)(ua * curve.rint);
+	log_sample(bs, vc);
+	double left = lookup(vc);
+	if (left >= 0 && bs->energy_full > 0) {
+		sc->percent = 100.0 * left / bs->energy_full;
+		if (sc->percent > 100) sc->percent = 100;
+	}
+	const batinfo_t *bi = battery_info();
+	long vmin = bi ? bi->vmin : -1;
+	int low = (bs->percent <= SOC_LOW_PCT
+				|| (sc->percent >= 0 && sc->percent <= SOC_LOW_PCT));
+	if (vmin > 0 && bs->voltage < vmin && low) sc->cliff = 1;
+	time_t dt = bs->when - prev.when;
+	if (prev.when && dt > 0 && dt <= 120
+		&& (prevvc - vc) / dt > SOC_CLIFF_UVS) sc->cliff = 1;
+	prev = *bs;
+	prevvc = vc;
+} // soc_update()
+
+void soc_end_discharge(int empty)
+{	/* The discharge is over. If it ran the battery flat, or as near as
+	 * a cliff, learn from it. Either way start a new log next time.
+	*/
+	if (!curvefn[0]) load_curve();
+	if (fileexists(datadir_path(datadir, "discharge.log")) == -1) return;
+	if (empty) learn_flat_discharge();
+	unlink(datadir_path(datadir, "discharge.log"));
+	save_curve();
+} // soc_end_discharge()
+
+static void load_curve(void)
+{	/* The curve for this battery, or a blank one spanning its design
+	 * voltages. A discharge log left over from before this boot means
+	 * the machine went down some other way. If the log ends at the
+	 * design minimum or on a cliff it ran flat, else it is dropped.
+	*/
+	const batinfo_t *bi = battery_info();
+	char id[NAME_MAX];
+	char name[2 * NAME_MAX];
+	battery_id(id, NAME_MAX);
+	sprintf(name, "curve-%s.dat", id);
+	strcpy(curvefn, datadir_path(datadir, name));
+	FILE *fpi = fopen(curvefn, "r");
+	if (!fpi || fread(&curve, sizeof(curve_t), 1, fpi) != 1
+		|| curve.magic != CURVE_MAGIC) {
+		memset(&curve, 0, sizeof(curve_t));
+		long vmin = bi ? bi->vmin : -1;
+		long vmax = bi ? bi->vmax : -1;
+		if (vmin > 0) {
+			if (vmax <= vmin) vmax = vmin * 13 / 10;
+			curve.magic = CURVE_MAGIC;
+			curve.vlow = vmin * 8 / 10;
+			curve.vstep = (vmax * 11 / 10 - curve.vlow) / SOC_BINS;
+		}
+	}
+	if (fpi) fclose(fpi);
+	dlrec_t end[2];	// the last two samples logged
+	fpi = fopen(datadir_path(datadir, "discharge.log"), "r");
+	if (!fpi) return;
+	int n = 0;
+	if (fseek(fpi, -2 * (long)sizeof(dlrec_t), SEEK_END) == 0) {
+		n = fread(end, sizeof(dlrec_t), 2, fpi);
+	} else if (fseek(fpi, 0, SEEK_SET) == 0) {	// only the one
+		n = fread(&end[1], sizeof(dlrec_t), 1, fpi);
+	}
+	fclose(fpi);
+	if (n && end[1].when >= boot_time()) return;	// still going
+	long vmin = bi ? bi->vmin : -1;
+	int flat = (n && vmin > 0
+				&& end[1].voltage <= vmin + vmin * SOC_FLAT_PCT / 100);
+	time_t dt = end[1].when - end[0].when;
+	if (n == 2 && dt > 0 && dt <= 120
+		&& (end[0].voltage - end[1].voltage) / dt > SOC_CLIFF_UVS) {
+		flat = 1;
+	}
+	soc_end_discharge(flat);
+} // load_curve()
+
+static void save_curve(void)
+{
+	if (!curve.vstep) return;
+	FILE *fpo = fopen(curvefn, "w");
+	if (!fpo) return;
+	fwrite(&curve, sizeof(curve_t), 1, fpo);
+	fclose(fpo);
+} // save_curve()
+
+static void log_sample(const batsample_t *bs, long vc)
+{
+	dlrec_t rec = { bs->when, vc, bs->power };
+	FILE *fpo = fopen(datadir_path(datadir, "discharge.log"), "a");
+	if (!fpo) return;
+	fwrite(&rec, sizeof(dlrec_t), 1, fpo);
+	fclose(fpo);
+} // log_sample()
+
+static void learn_flat_discharge(void)
+{	/* Walk back from the end, where nothing was left, adding up the
+	 * energy drawn, and average it into the bin of each voltage.
+	*/
+	fdata fd = readfile(datadir_path(datadir, "discharge.log"), 0, 0);
+	if (!fd.from || !curve.vstep) {
+		free(fd.from);
+		return;
+	}
+	dlrec_t *rec = (dlrec_t *)fd.from;
+	long n = (fd.to - fd.from) / sizeof(dlrec_t);
+	double left = 0;
+	long i;
+	for (i = n - 1; i >= 0; i--) {
+		if (i < n - 1 && rec[i].power > 0 && rec[i+1].power > 0) {
+			double secs = rec[i+1].when - rec[i].when;
+			left += (rec[i].power + rec[i+1].power) / 2.0 * secs / 3600;
+		}
+		int b = vbin(rec[i].voltage);
+		if (b < 0) continue;
+		int c = curve.count[b] < 8 ? curve.count[b] : 8;	// keep learning
+		curve.remain[b] = (curve.remain[b] * c + left) / (c + 1);
+		curve.count[b]++;
+	}
+	free(fd.from);
+} // learn_flat_discharge()
+
+static int vbin(long vc)
+{
+	long b = (vc - curve.vlow) / curve.vstep;
+	if (vc < curve.vlow || b >= SOC_BINS) return -1;
+	return b;
+} // vbin()
+
+static double lookup(long vc)
+{	/* uWh left at corrected voltage vc, interpolated between the
+	 * nearest learned bins either side, -1 if nothing is learned.
+	*/
+	double pos = (double)(vc - curve.vlow) / curve.vstep - 0.5;
+	int lo = -1, hi = -1;
+	int b;
+	for (b = 0; b < SOC_BINS; b++) {
+		if (!curve.count[b]) continue;
+		if (b <= pos) lo = b;
+		if (b >= pos && hi == -1) hi = b;
+	}
+	if (lo == -1 && hi == -1) return -1;
+	if (lo == -1) return curve.remain[hi] * (pos < 0 ? 0 : pos / hi);
+	if (hi == -1 || hi == lo) return curve.remain[lo];
+	double f = (pos - lo) / (hi - lo);
+	return curve.remain[lo] + f * (curve.remain[hi] - curve.remain[lo]);
+} // lookup()
+
+static time_t boot_time(void)
+{
+	time_t btime = 0;
+	char line[NAME_MAX];
+	FILE *fpi = fopen("/proc/stat", "r");
+	if (!fpi) return 0;
+	while (fgets(line, NAME_MAX, fpi)) {
+		if (strncmp(line, "btime ", 6) == 0) {
+			btime = strtol(line + 6, NULL, 10);
+			break;
+		}
+	}
+	fclose(fpi);
+	return btime;
+} // boot_time()
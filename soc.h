@@ -0,0 +1,46 @@
+/*
+ * soc.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _SOC_H
+#define _SOC_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "fileops.h"
+#include "battery.h"
+
+#define SOC_BINS 64			// voltage steps in the discharge curve
+#define SOC_FAST_SECS 10	// check interval near quit_level
+#define SOC_CLIFF_UVS 2000	// uV a second, 120 mV a minute, is a cliff
+#define SOC_FLAT_PCT 3		// % over design minimum still counted as flat
+#define SOC_LOW_PCT 10		// charge at which under design minimum is a cliff
+
+typedef struct soc_t {
+	int percent;	// charge left by voltage, -1 not known
+	int cliff;		// voltage is falling away, go down now
+} soc_t;
+
+void soc_dir(const char *dir);
+void soc_update(const batsample_t *bs, soc_t *sc);
+void soc_end_discharge(int empty);
+
+#endif
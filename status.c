@@ -0,0 +1,214 @@
+/* status.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "status.h"
+#include "resume.h"
+
+/* The running instance publishes its latest sample in a small POSIX
+ * shared memory segment guarded by a sequence lock. The sequence is odd
+ * while the writer is updating, so readers copy the record and retry if
+ * the sequence changed underneath them. Readers never block the writer.
+ * A segment left by another build, or by a writer that died between
+ * creating and sizing it, is not of this size and layout: readers take
+ * it as no status and the next writer lays it out afresh.
+*/
+#define STATUS_MAGIC 0x44534f41	// "AOSD"
+#define STATUS_VERSION 5		// bump when status_t changes
+
+typedef struct statseg_t {
+	unsigned magic;
+	unsigned version;
+	unsigned size;		// sizeof(statseg_t)
+	unsigned seq;
+	status_t st;
+} statseg_t;
+
+static statseg_t *wseg;	// writer mapping, NULL until first publish
+static int wstate;		// 0 untried, 1 mapped, -1 unavailable
+
+static int read_segment(status_t *st, uid_t *owner);
+static int open_writer(int sysmode);
+static int seg_valid(const statseg_t *seg);
+static const char *state_name(int state);
+
+void status_publish(const status_t *st)
+{	/* Only one instance may write; if another holds the segment lock,
+	 * or it can not be created, publishing is silently disabled.
+	*/
+	if (wstate == 0) wstate = open_writer(st->sysmode);
+	if (wstate != 1) return;
+	unsigned seq = wseg->seq;
+	__atomic_store_n(&wseg->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&wseg->st, st, sizeof(status_t));
+	__atomic_store_n(&wseg->seq, seq + 2, __ATOMIC_RELEASE);
+} // status_publish()
+
+int status_read(status_t *st)
+{	/* Copy the latest published status, returns -1 if there is none. */
+	uid_t owner;
+	return read_segment(st, &owner);
+} // status_read()
+
+static int read_segment(status_t *st, uid_t *owner)
+{	/* status_read(), also giving the owner of the segment. */
+	int fd = shm_open(STATUS_SHM, O_RDONLY, 0);
+	if (fd == -1) return -1;
+	struct stat sb;
+	if (fstat(fd, &sb) == -1 || sb.st_size != sizeof(statseg_t)) {
+		close(fd);	// mapping past its end would raise SIGBUS
+		return -1;
+	}
+	*owner = sb.st_uid;
+	statseg_t *seg = mmap(NULL, sizeof(statseg_t), PROT_READ,
+							MAP_SHARED, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED) return -1;
+	if (!seg_valid(seg)) {
+		munmap(seg, sizeof(statseg_t));
+		return -1;
+	}
+	int tries = 1000;	// a writer killed mid update leaves seq odd
+	unsigned s1, s2;
+	do {
+		s1 = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+		memcpy(st, &seg->st, sizeof(status_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		s2 = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+	} while ((s1 != s2 || (s1 & 1)) && --tries);
+	munmap(seg, sizeof(statseg_t));
+	if (!tries || s1 == 0) return -1;
+	return 0;
+} // read_segment()
+
+int status_show(void)
+{	/* Report the published status, no sysfs access. Returns an exit
+	 * status: 0 when an instance is running, 1 otherwise.
+	*/
+	status_t st;
+	if (status_read(&st) == -1) {
+		fputs("No status has been published.\n", stdout);
+		return 1;
+	}
+	int alive = (kill(st.pid, 0) == 0 || errno == EPERM);
+	fprintf(stdout, "pid %d (%s%s), sampled %lds ago\n", st.pid,
+			st.sysmode ? "system daemon, " : "",
+			alive ? "running" : "not running",
+			(long)(time(NULL) - st.sampled));
+	fprintf(stdout, "Mains power: %s\n", st.acon ? "on" : "off");
+	fprintf(stdout, "Battery percentage: %d%s\n", st.percent,
+			st.estimated ? " (estimated, read was late)" : "");
+	fprintf(stdout, "State: %s\n", state_name(st.state));
+	if (st.minsleft >= 0) {
+		fprintf(stdout, "Predicted minutes to quit_level: %d\n",
+				st.minsleft);
+	}
+	if (st.loadmins >= 0) {
+		fprintf(stdout, "At this load %.1f W, %d minutes to quit_level",
+				st.loadmw / 1000.0, st.loadmins);
+		if (st.cronjobs) {
+			fprintf(stdout, ", %d with %d cron jobs starting",
+					st.cronmins, st.cronjobs);
+		}
+		fputc('\n', stdout);
+	}
+	if (st.stalls) {
+		fprintf(stdout, "Stalled sysfs reads: %d\n", st.stalls);
+	}
+	fprintf(stdout, "check_interval=%d monitor_level=%d quit_level=%d\n",
+			st.interval / 60, st.batmon, st.batquit);
+	resume_show();
+	return !alive;
+} // status_show()
+
+int status_daemon_running(void)
+{	/* Is a system daemon looking after the battery already? Only a
+	 * segment of root's is believed, any user could make one that says
+	 * so and stop every cron instance.
+	*/
+	status_t st;
+	uid_t owner;
+	if (read_segment(&st, &owner) == -1 || !st.sysmode || owner != 0) {
+		return 0;
+	}
+	return (kill(st.pid, 0) == 0 || errno == EPERM);
+} // status_daemon_running()
+
+static int open_writer(int sysmode)
+{	/* The system daemon makes afresh a segment some other user made,
+	 * rather than be locked out of it.
+	*/
+	int fd = shm_open(STATUS_SHM, O_RDWR | O_CREAT, 0644);
+	struct stat sb;
+	if (fd != -1 && sysmode && (fstat(fd, &sb) == -1 || sb.st_uid != 0)) {
+		close(fd);
+		shm_unlink(STATUS_SHM);
+		fd = shm_open(STATUS_SHM, O_RDWR | O_CREAT | O_EXCL, 0644);
+	}
+	if (fd == -1) return -1;
+	// the lock lives as long as this process keeps fd open.
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+		return -1;
+	}
+	int fresh = (fstat(fd, &sb) == -1 || sb.st_size != sizeof(statseg_t));
+	if ((fresh && ftruncate(fd, 0) == -1)
+		|| ftruncate(fd, sizeof(statseg_t)) == -1) {
+		close(fd);
+		return -1;
+	}
+	wseg = mmap(NULL, sizeof(statseg_t), PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+	if (wseg == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if (fresh || !seg_valid(wseg)) {	// lay it out afresh
+		memset(wseg, 0, sizeof(statseg_t));
+		wseg->version = STATUS_VERSION;
+		wseg->size = sizeof(statseg_t);
+		__atomic_store_n(&wseg->magic, STATUS_MAGIC, __ATOMIC_RELEASE);
+	}
+	if (wseg->seq & 1) wseg->seq++;	// previous writer died mid update
+	return 1;
+} // open_writer()
+
+static int seg_valid(const statseg_t *seg)
+{	/* Was seg, already known to be the right size, laid out by this
+	 * build?
+	*/
+	return __atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) == STATUS_MAGIC
+			&& seg->version == STATUS_VERSION
+			&& seg->size == sizeof(statseg_t);
+} // seg_valid()
+
+static const char *state_name(int state)
+{
+	switch (state)
+	{
+		case ST_IDLE:
+			return "idle";
+		case ST_MONITOR:
+			return "monitoring";
+		case ST_SHUTDOWN:
+			return "shutting down";
+	}
+	return "unknown";
+} // state_name()
@@ -0,0 +1,64 @@
+/*
+ * status.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _STATUS_H
+#define _STATUS_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#define STATUS_SHM "/autosd.status"
+
+enum { ST_IDLE, ST_MONITOR, ST_SHUTDOWN };
+
+typedef struct status_t {
+	pid_t pid;			// instance that published this
+	time_t sampled;		// time of the last sysfs sample
+	int acon;			// mains power online
+	int percent;		// battery charge %
+	int state;			// ST_IDLE, ST_MONITOR or ST_SHUTDOWN
+	int minsleft;		// predicted minutes to quit_level, -1 unknown
+	int batmon;			// config in force when sampled
+	int batquit;
+	int interval;		// seconds
+	int sysmode;		// published by the system daemon
+	int stalls;			// sysfs reads that missed their deadline
+	int estimated;		// percent is extrapolated from a late read
+	int loadmw;			// modelled draw at the current load, mW
+	int loadmins;		// to quit_level at that draw, -1 unknown
+	int cronmins;		// the same with cron jobs starting as due
+	int cronjobs;		// jobs due to start before then
+} status_t;
+
+void status_publish(const status_t *st);
+int status_read(status_t *st);
+int status_show(void);
+int status_daemon_running(void);
+
+#endif
@@ -0,0 +1,180 @@
+/* suspend.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "suspend.h"
+
+/* sleep() stops counting while the machine is suspended, so a laptop
+ * suspended on battery was never looked at again. Waits are timed on
+ * CLOCK_BOOTTIME instead, which does count suspended time, and with
+ * suspend_wake=1 on CLOCK_BOOTTIME_ALARM, which also wakes the machine.
+ * The difference between the boot time and monotonic clocks over a wait
+ * is the time spent suspended, and with the energy used over it gives
+ * the drain rate while suspended.
+ *
+ * Whether it was our alarm that ended a suspend is told by how long the
+ * machine had been awake when the alarm went off. The kernel cancels a
+ * CLOCK_REALTIME timerfd armed with TFD_TIMER_CANCEL_ON_SET on every
+ * resume, which marks the moment. Our alarm goes off at once on the
+ * resume it caused; one that goes off well after a resume found the
+ * user already back.
+*/
+
+static void arm_resume(suspguard_t *sg);
+static void read_resume(suspguard_t *sg);
+
+void suspend_init(suspguard_t *sg, int wake)
+{
+	memset(sg, 0, sizeof(suspguard_t));
+	sg->energy0 = -1;
+	sg->tfd = -1;
+	sg->rfd = -1;
+	if (wake) {	// needs CAP_WAKE_ALARM
+		sg->tfd = timerfd_create(CLOCK_BOOTTIME_ALARM, TFD_CLOEXEC);
+		if (sg->tfd == -1) {
+			fputs("suspend_wake: no wake alarm permitted, suspended"
+					" time will be counted but not guarded.\n", stderr);
+		}
+	}
+	sg->alarm = (sg->tfd != -1);
+	if (sg->tfd == -1) {
+		sg->tfd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC);
+	}
+	if (sg->tfd == -1) {
+		perror("timerfd_create()");
+		exit(EXIT_FAILURE);
+	}
+	if (sg->alarm) {
+		sg->rfd = timerfd_create(CLOCK_REALTIME,
+									TFD_CLOEXEC | TFD_NONBLOCK);
+		arm_resume(sg);
+	}
+} // suspend_init()
+
+void suspend_arm(suspguard_t *sg, int secs, long energy)
+{
+	struct itimerspec its = { { 0, 0 }, { secs, 0 } };
+	if (timerfd_settime(sg->tfd, 0, &its, NULL) == -1) {
+		perror("timerfd_settime()");
+		exit(EXIT_FAILURE);
+	}
+	sg->boot0 = clock_ms(CLOCK_BOOTTIME);
+	sg->mono0 = clock_ms(CLOCK_MONOTONIC);
+	sg->resumed = 0;
+	sg->energy0 = energy;
+} // suspend_arm()
+
+void suspend_kick(suspguard_t *sg)
+{	/* End the current wait now. Safe from another thread. */
+	struct itimerspec its = { { 0, 0 }, { 0, 1 } };
+	timerfd_settime(sg->tfd, 0, &its, NULL);
+} // suspend_kick()
+
+int suspend_wait(suspguard_t *sg, int ufd)
+{	/* Wait for the armed timer or, if ufd is not -1, a power_supply
+	 * uevent. Returns 1 for the uevent, 0 for the timer.
+	*/
+	struct pollfd pfd[3] = { { sg->tfd, POLLIN, 0 }, { ufd, POLLIN, 0 },
+								{ sg->rfd, POLLIN, 0 } };
+	int fired = 0;
+	while (1) {
+		if (poll(pfd, 3, -1) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll()");
+			exit(EXIT_FAILURE);
+		}
+		if (pfd[0].revents) {
+			uint64_t count;
+			if (read(sg->tfd, &count, sizeof(count)) > 0) fired = 1;
+			break;
+		}
+		if (pfd[1].revents && uevent_wait(ufd, 0)) break;
+		if (pfd[2].revents) read_resume(sg);
+	}
+	read_resume(sg);	// the kernel may not have told us yet
+	long now = clock_ms(CLOCK_MONOTONIC);
+	long boot = clock_ms(CLOCK_BOOTTIME) - sg->boot0;
+	sg->slept = (boot - (now - sg->mono0)) / 1000;
+	/* The alarm went off within seconds of the resume, so it was ours
+	 * that woke the machine and nobody is using it.
+	*/
+	long awake = sg->resumed ? now - sg->resumed : 0;
+	sg->ours = (sg->alarm && fired && sg->slept > 0 && sg->rfd != -1
+				&& awake <= SUSP_AWAKE_MAX * 1000L);
+	return !fired;
+} // suspend_wait()
+
+void suspend_account(suspguard_t *sg, long energy)
+{	/* Given the energy now, update the drain rate while suspended from
+	 * a wait that was mostly spent suspended.
+	*/
+	if (sg->slept < 60 || sg->energy0 <= 0 || energy < 0) return;
+	double secs = (clock_ms(CLOCK_BOOTTIME) - sg->boot0) / 1000.0;
+	if (sg->slept < 0.9 * secs) return;
+	double rate = (sg->energy0 - energy) / secs;
+	if (rate < 0) rate = 0;	// charging, or the gauge moved up
+	sg->rate = sg->rate ? (sg->rate + rate) / 2 : rate;
+} // suspend_account()
+
+int suspend_next(const suspguard_t *sg, long energy, long quitenergy,
+					int least)
+{	/* Seconds to stay suspended before looking again: half the time to
+	 * quitenergy at the measured drain, so the checks get closer as it
+	 * nears. 0 means it would be crossed before least seconds.
+	*/
+	if (sg->rate <= 0) return least;
+	double secs = (energy - quitenergy) / sg->rate;
+	if (secs <= least) return 0;
+	secs /= 2;
+	if (secs < least) secs = least;
+	if (secs > SUSP_WAIT_MAX) secs = SUSP_WAIT_MAX;
+	return secs;
+} // suspend_next()
+
+void suspend_close(suspguard_t *sg)
+{
+	if (sg->tfd != -1) close(sg->tfd);
+	if (sg->rfd != -1) close(sg->rfd);
+	sg->tfd = -1;
+	sg->rfd = -1;
+} // suspend_close()
+
+static void arm_resume(suspguard_t *sg)
+{	/* A year ahead, it is only there to be cancelled. */
+	if (sg->rfd == -1) return;
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+	clock_gettime(CLOCK_REALTIME, &its.it_value);
+	its.it_value.tv_sec += 365 * 86400;
+	if (timerfd_settime(sg->rfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+						&its, NULL) == -1) {
+		close(sg->rfd);
+		sg->rfd = -1;
+	}
+} // arm_resume()
+
+static void read_resume(suspguard_t *sg)
+{	/* Note a resume, or a step of the wall clock, and arm again. */
+	if (sg->rfd == -1) return;
+	uint64_t count;
+	if (read(sg->rfd, &count, sizeof(count)) != -1 || errno != ECANCELED) {
+		return;
+	}
+	sg->resumed = clock_ms(CLOCK_MONOTONIC);
+	arm_resume(sg);
+} // read_resume()
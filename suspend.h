@@ -0,0 +1,60 @@
+/*
+ * suspend.h
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#ifndef _SUSPEND_H
+#define _SUSPEND_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include "fileops.h"
+#include "uevent.h"
+
+#define SUSP_AWAKE_MAX 5		// most seconds from resume to our alarm
+#define SUSP_WAIT_MAX (12 * 3600)	// longest wait while suspended
+
+typedef struct suspguard_t {
+	int tfd;		// timerfd on CLOCK_BOOTTIME(_ALARM)
+	int rfd;		// timerfd cancelled by each resume, -1 if none
+	int alarm;		// the timer wakes the machine from suspend
+	long boot0;		// clocks when the timer was armed, ms
+	long mono0;
+	long resumed;	// CLOCK_MONOTONIC ms of the last resume seen, 0 none
+	long energy0;	// uWh then, -1 unknown
+	int slept;		// seconds suspended during the last wait
+	int ours;		// the timer woke the machine and nobody is using it
+	double rate;	// uWh per second drawn while suspended, 0 unknown
+} suspguard_t;
+
+void suspend_init(suspguard_t *sg, int wake);
+void suspend_arm(suspguard_t *sg, int secs, long energy);
+void suspend_kick(suspguard_t *sg);
+int suspend_wait(suspguard_t *sg, int ufd);
+void suspend_account(suspguard_t *sg, long energy);
+int suspend_next(const suspguard_t *sg, long energy, long quitenergy,
+					int least);
+void suspend_close(suspguard_t *sg);
+
+#endif
@@ -0,0 +1,64 @@
+/* uevent.c
+ *
+ * Copyright 2016 Bob Parker <rlp1938@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+#include "uevent.h"
+
+/* The kernel announces mains plugged or pulled, and battery changes,
+ * as power_supply uevents on a netlink socket. Waiting on that lets us
+ * react at once instead of on the next poll.
+*/
+
+int uevent_open(void)
+{	/* Returns the socket, or -1 if uevents are not available here. */
+	struct sockaddr_nl addr = { 0 };
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;	// let the kernel pick
+	addr.nl_groups = 1;	// kernel events, as opposed to udev's
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+					NETLINK_KOBJECT_UEVENT);
+	if (fd == -1) return -1;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+} // uevent_open()
+
+int uevent_wait(int fd, int ms)
+{	/* Wait up to ms milliseconds, -1 for ever, for a power_supply
+	 * uevent. Returns 1 if one came, 0 otherwise. Other events are
+	 * drained and ignored. With fd -1 this is just a sleep.
+	*/
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	if (poll(&pfd, fd == -1 ? 0 : 1, ms) <= 0) return 0;
+	int found = 0;
+	char buf[4096];
+	ssize_t len;
+	while ((len = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[len] = '\0';
+		// NUL separated: "action@devpath", then KEY=value pairs.
+		char *cp = buf;
+		while (cp < buf + len) {
+			if (strcmp(cp, "SUBSYSTEM=power_supply") == 0) found = 1;
+			cp += strlen(cp) + 1;
+		}
+	}
+	return found;
+} // uevent_wait()